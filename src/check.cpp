@@ -0,0 +1,146 @@
+// Every other way of rendering must give the same graph as `seed::render`
+// of the parsed source: roots built with `seed::Builder`, `--fused`
+// straight from the tokens and `--cache` from the fragments of a warm
+// cache, rewritten by `--rules` or not.
+
+#define SEED_NO_MAIN
+#include "main.cpp"
+
+
+namespace {
+	bool check(const std::string& what, const std::string& expected, const std::string& got) {
+		if (got != expected) {
+			std::cerr << "error: " << what << " does not hold.\n"
+				"expected:\n" << expected << "got:\n" << got;
+
+			return false;
+		}
+
+		std::cout << "ok: " << what << ".\n";
+		return true;
+	}
+
+
+	bool builder() {
+		const std::string src =
+			"(define x \"y\")\n"
+			"()\n"
+			"(if (< a b) (print 'say \"hi\"') else)\n"
+			"(list (nested (deeper (deepest))) () leaf)\n";
+
+		seed::Lexer lex{src.c_str()};
+		seed::AST tree;
+
+		auto roots = seed::parse(lex, tree);
+
+		seed::Builder b;
+
+		b.root(b.list("define", { b.identifier("x"), b.string("y") }));
+		b.root(b.empty());
+
+		b.root(b.list("if", {
+			b.list("<", { b.identifier("a"), b.identifier("b") }),
+			b.list("print", { b.string("say \"hi\"") }),
+			b.identifier("else"),
+		}));
+
+		b.root(b.list("list", {
+			b.list("nested", { b.list("deeper", { b.list("deepest") }) }),
+			b.empty(),
+			b.identifier("leaf"),
+		}));
+
+		return check("builder renders like the parser", seed::render(roots, tree), seed::render(b.roots(), b.tree()));
+	}
+
+
+	// Empty lists, string operators, escapes and nesting, at the top level
+	// and inside lists.
+	const std::string corpus =
+		"()\n"
+		"(a)\n"
+		"(a () b ())\n"
+		"(\"op\" x \"y\")\n"
+		"('op' (\"nested op\" ()) 'z')\n"
+		"(print 'say \"hi\"' \\\"quoted \\'x)\n"
+		"(a (b (c (d (e (f ()) g) h) i) j) k)\n"
+		"  (  spaced\t( out )\n)\n"
+		"(twice (a b (c d)))\n"
+		"(dup (p q) z)\n"
+		"(keep (twice x) (dup ()))\n"
+		"()\n";
+
+
+	bool fused() {
+		seed::Lexer lex{corpus.c_str()};
+		seed::AST tree;
+
+		auto roots = seed::parse(lex, tree);
+
+		seed::Progress counts;
+		return check("fused renders like the parser", seed::render(roots, tree), seed::render_fused("corpus", corpus, "digraph", counts));
+	}
+
+
+	// A cold cache, the same cache once its fragments are in and a new one
+	// that maps the saved snapshot.
+	bool cached(const std::string& tmp, bool rewrite) {
+		seed::Options opts;
+
+		if (rewrite) {
+			seed::write_atomic(tmp + ".rules",
+				"(rule (twice ?x) (pair ?x ?x))\n"
+				"(rule (dup ?xs...) (both (l ?xs...) (r ?xs...)))\n"
+			);
+
+			opts.rules = std::make_shared<const seed::Rules>(tmp + ".rules");
+		}
+
+		seed::Lexer lex{corpus.c_str()};
+		seed::AST tree;
+
+		auto roots = seed::parse(lex, tree);
+
+		if (opts.rules)
+			opts.rules->rewrite(tree, roots);
+
+		const std::string expected = seed::render(roots, tree);
+		const std::string what = rewrite ? "cached renders like the parser after rules" : "cached renders like the parser";
+
+		seed::Progress counts;
+		bool ok = true;
+
+		{
+			seed::Cache cache{tmp + ".cache"};
+
+			ok &= check(what + ", cold", expected, seed::render_cached(roots, tree, cache, seed::options_key(opts), "digraph", counts));
+			ok &= check(what + ", warm", expected, seed::render_cached(roots, tree, cache, seed::options_key(opts), "digraph", counts));
+
+			cache.save();
+		}
+
+		seed::Cache cache{tmp + ".cache"};
+		ok &= check(what + ", from a snapshot", expected, seed::render_cached(roots, tree, cache, seed::options_key(opts), "digraph", counts));
+
+		return ok;
+	}
+}
+
+
+int main() {
+	const std::string tmp = (std::filesystem::temp_directory_path() / ("seed-check." + std::to_string(::getpid()))).string();
+
+	bool ok = builder();
+
+	ok &= fused();
+	ok &= cached(tmp, false);
+	ok &= cached(tmp + ".rewritten", true);
+
+	std::error_code ec;
+
+	for (const char* suffix: { ".cache", ".rewritten.cache", ".rewritten.rules" }) {
+		std::filesystem::remove(tmp + suffix, ec);
+	}
+
+	return ok ? 0 : 1;
+}
@@ -7,488 +7,3795 @@
 #include <string>
 #include <vector>
 #include <variant>
+#include <string_view>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <map>
+#include <tuple>
+#include <chrono>
+#include <iomanip>
+#include <charconv>
+#include <system_error>
+#include <limits>
+#include <cstdio>
+#include <csignal>
+#include <condition_variable>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <signal.h>
+
+#include <zlib.h>
+
+#include <seed.hpp>
 
 
 namespace seed {
+	inline std::atomic<bool> failed{false};  // errors were reported but not fatal.
+
+
+	// Counters of the whole run sampled by the progress reporter. A worker
+	// that needs its own share counts into a `seed::Progress` attached
+	// while it runs, everything else counts into `shared`.
+	class RunProgress {
+		private:
+			mutable std::mutex mtx;
+			std::vector<const seed::Progress*> running;
+			seed::Progress finished;
+
+
+		private:
+			static void add(seed::Progress& to, const seed::Progress& from) {
+				for (auto field: { &seed::Progress::lexed, &seed::Progress::nodes, &seed::Progress::rendered, &seed::Progress::done }) {
+					(to.*field).fetch_add((from.*field).load(std::memory_order_relaxed), std::memory_order_relaxed);
+				}
+			}
+
+
+		public:
+			std::atomic<uint64_t> total{0};  // bytes of input.
+			std::atomic<uint64_t> files{0};
+			seed::Progress shared;
+
+
+		public:
+			void attach(const seed::Progress& counts) {
+				std::lock_guard<std::mutex> lock{mtx};
+				running.emplace_back(&counts);
+			}
+
+			void detach(const seed::Progress& counts) {
+				std::lock_guard<std::mutex> lock{mtx};
+
+				running.erase(std::find(running.begin(), running.end(), &counts));
+				add(finished, counts);
+			}
+
+			uint64_t sum(std::atomic<uint64_t> seed::Progress::* field) const {
+				std::lock_guard<std::mutex> lock{mtx};
+				uint64_t n = (finished.*field).load(std::memory_order_relaxed) + (shared.*field).load(std::memory_order_relaxed);
+
+				for (const seed::Progress* counts: running) {
+					n += (counts->*field).load(std::memory_order_relaxed);
+				}
+
+				return n;
+			}
+	};
+
+	inline RunProgress progress;
+
+
+	// Run `fn` on `jobs` threads, the calling thread included.
+	template <typename F>
+	inline void parallel(unsigned jobs, F&& fn) {
+		std::vector<std::thread> workers;
+
+		for (unsigned i = 1; i < jobs; ++i) {
+			workers.emplace_back(fn);
+		}
+
+		fn();
+
+		for (auto& t: workers) {
+			t.join();
+		}
+	}
+
+
+	// The whole of `str` as a number, anything else is an error.
+	template <typename T>
+	inline T parse_number(std::string_view str, std::string_view what) {
+		T value{};
+		auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+
+		if (str.empty() or ec != std::errc{} or ptr != str.data() + str.size())
+			error("invalid ", what, " `", str, "`.");
+
+		return value;
+	}
+
+
 	inline std::string read_file(const std::string& fname) {
 		auto filesize = std::filesystem::file_size(fname);
 		std::ifstream is(fname, std::ios::binary);
 
-		auto str = std::string(filesize + 1, '\0');
-		is.read(str.data(), static_cast<std::streamsize>(filesize));
+		auto str = std::string(filesize + 1, '\0');
+		is.read(str.data(), static_cast<std::streamsize>(filesize));
+
+		return str;
+	}
+}
+
+
+namespace seed {
+	// Same output as `parse` followed by `render` but written straight from
+	// the token stream: ids are handed out in the same preorder and the
+	// only state kept is the stack of ids of the lists still open. The
+	// output is handed to `flush` whenever it reaches `chunk` bytes and at
+	// the end, so apart from the source it takes O(chunk + depth) memory.
+	// It stops at the first syntax error and returns it, what was flushed
+	// before that is up to the caller to throw away.
+	template <typename F>
+	inline seed::Diagnostic render_fused(
+		const std::string& src,
+		const std::string& title,
+		size_t chunk,
+		seed::Progress& counts,
+		F&& flush
+	) {
+		seed::Lexer lex{src.c_str()};
+
+		std::vector<int> open;
+		std::vector<const char*> parens;  // `(` of each open list, for errors.
+		std::string str = title + " {\n";
+
+		int node_counter = 0;
+		uint64_t nodes = 0, flushed = 0;
+		char buf[16];
+
+		auto drain = [&] {
+			flushed += str.size();
+			flush(str);
+			str.clear();
+		};
+
+		auto id = [&] (int n) {
+			auto [ptr, ec] = std::to_chars(buf, buf + sizeof(buf), n);
+			str += 'n';
+			str.append(buf, ptr);
+		};
+
+		auto node = [&] (int self_id, const seed::Token& tok, bool escape) {
+			nodes++;
+			str += "\t\t";
+			id(self_id);
+			str += " [label=\"";
+
+			const auto& [begin, length] = tok.view;
+
+			if (escape) {
+				for (const char* ptr = begin; ptr != begin + length; ++ptr) {
+					if (*ptr == '"')
+						str += "\\\"";
+					else
+						str += *ptr;
+				}
+			}
+
+			else {
+				str.append(begin, static_cast<size_t>(length));
+			}
+
+			str += "\"];\n";
+
+			if (not open.empty()) {
+				str += "\t\t";
+				id(open.back());
+				str += " -> ";
+				id(self_id);
+				str += ";\n";
+			}
+		};
+
+		seed::Diagnostic err;
+
+		auto fail = [&] (const char* at, const char* msg) {
+			err = { at, msg };
+			return err;
+		};
+
+		// Called after `(`, an empty list renders nothing.
+		auto list = [&] (const seed::Token& paren) {
+			seed::Token op = lex.advance();
+
+			if (op == TOKEN_RPAREN) {
+				if (not open.empty())
+					node_counter++;
+
+				return true;
+			}
+
+			if (op != TOKEN_IDENTIFIER and op != TOKEN_STRING) {
+				fail(op.view.begin, "expected identifer or string.");
+				return false;
+			}
+
+			int self_id = node_counter++;
+			node(self_id, op, false);
+
+			open.emplace_back(self_id);
+			parens.emplace_back(paren.view.begin);
+
+			return true;
+		};
+
+		int graph_id = 0;
+
+		while (lex.peek() != TOKEN_EOF) {
+			seed::Token paren = lex.advance();
+
+			uint64_t before = flushed + str.size();
+			uint64_t before_nodes = nodes;
+
+			if (paren != TOKEN_LPAREN)
+				return fail(paren.view.begin, "expected `(`.");
+
+			str += "\tsubgraph cluster";
+			str += std::to_string(graph_id++);
+			str += " {\n";
+
+			if (not list(paren))
+				return err;
+
+			while (not open.empty()) {
+				seed::Token tok = lex.advance();
+
+				if (tok == TOKEN_LPAREN) {
+					if (not list(tok))
+						return err;
+				}
+
+				else if (tok == TOKEN_IDENTIFIER or tok == TOKEN_STRING) {
+					node(node_counter++, tok, tok == TOKEN_STRING);
+					node_counter++;
+				}
+
+				else if (tok == TOKEN_RPAREN) {
+					open.pop_back();
+					parens.pop_back();
+
+					if (not open.empty())
+						node_counter++;
+				}
+
+				else {
+					return fail(parens.back(), "expected `)`.");
+				}
+
+				if (str.size() >= chunk)
+					drain();
+			}
+
+			node_counter++;
+			str += "\t}\n";
+
+			auto lexed = static_cast<uint64_t>(lex.peek().view.begin - paren.view.begin);
+
+			counts.lexed.fetch_add(lexed, std::memory_order_relaxed);
+			counts.nodes.fetch_add(nodes - before_nodes, std::memory_order_relaxed);
+			counts.rendered.fetch_add(flushed + str.size() - before, std::memory_order_relaxed);
+			counts.done.fetch_add(lexed, std::memory_order_relaxed);
+		}
+
+		str += "}\n";
+		drain();
+
+		return err;
+	}
+
+
+	// Reported like the recovering parser does.
+	[[noreturn]] inline void fused_error(const std::string& fname, const std::string& src, const seed::Diagnostic& err) {
+		seed::LineIndex lines{src.data(), src.data() + src.size()};
+		error(fname, ":", lines.position(err.at), ": ", err.message);
+	}
+
+
+	inline std::string render_fused(
+		const std::string& fname,
+		const std::string& src,
+		const std::string& title,
+		seed::Progress& counts
+	) {
+		std::string out;
+
+		auto err = render_fused(src, title, std::numeric_limits<size_t>::max(), counts, [&] (std::string& str) {
+			out.swap(str);
+		});
+
+		if (err.at != nullptr)
+			fused_error(fname, src, err);
+
+		return out;
+	}
+}
+
+
+namespace seed {
+	// Report every diagnostic at once, exits unless `partial` is set in
+	// which case the valid forms are still used. True if there were none.
+	inline bool report(
+		const std::string& fname,
+		const std::string& src,
+		const seed::Diagnostics& diags,
+		bool partial
+	) {
+		if (diags.empty())
+			return true;
+
+		seed::LineIndex lines{src.data(), src.data() + src.size()};
+		std::string str;
+
+		for (const auto& [at, message]: diags) {
+			str += strcat("error: ", fname, ":", lines.position(at), ": ", message, "\n");
+		}
+
+		std::cerr << str;
+		seed::failed = true;
+
+		if (not partial)
+			std::exit(1);
+
+		return false;
+	}
+
+
+	inline std::vector<seed::node_t> parse_file(
+		const std::string& fname,
+		const std::string& src,
+		seed::AST& tree,
+		bool partial,
+		seed::Profile* profile = nullptr,
+		seed::Progress* counts = &progress.shared,
+		bool* clean = nullptr
+	) {
+		seed::Lexer lex{src.c_str()};
+		seed::Diagnostics diags;
+
+		auto roots = seed::parse(lex, tree, diags, profile, counts);
+		bool none = report(fname, src, diags, partial);
+
+		if (clean != nullptr)
+			*clean = none;
+
+		return roots;
+	}
+}
+
+
+namespace seed {
+	// Original source bytes of a node, including quotes and parens.
+	inline seed::View span(const seed::AST& tree, seed::node_t n) {
+		return seed::visit(tree[n],
+			[] (const List& l) { return l.span; },
+			[] (const Empty& e) { return e.span; },
+
+			[] (const Identifer& x) {
+				const auto& [begin, length] = x.tok.view;
+
+				if (*(begin - 1) == '\\')
+					return seed::View{begin - 1, length + 1};
+
+				return x.tok.view;
+			},
+
+			[] (const String& x) {
+				const auto& [begin, length] = x.tok.view;
+				return seed::View{begin - 1, length + 2};
+			}
+		);
+	}
+
+
+	// Selects subtrees to extract, one of:
+	//   `3`      the fourth root.
+	//   `3/0/2`  a path of child indices starting from a root.
+	//   `@op`    every outermost list whose operator is `op`.
+	struct Selector {
+		std::vector<size_t> path;
+		std::string op;
+	};
+
+
+	inline Selector parse_selector(const std::string& str) {
+		Selector sel;
+
+		if (not str.empty() and str[0] == '@') {
+			sel.op = str.substr(1);
+
+			if (sel.op.empty())
+				error("selector `", str, "` has no operator.");
+
+			return sel;
+		}
+
+		size_t begin = 0;
+
+		while (begin <= str.size()) {
+			size_t end = std::min(str.find('/', begin), str.size());
+			std::string part = str.substr(begin, end - begin);
+
+			if (part.empty() or part.find_first_not_of("0123456789") != std::string::npos)
+				error("invalid selector `", str, "`.");
+
+			sel.path.emplace_back(parse_number<size_t>(part, "selector index"));
+			begin = end + 1;
+		}
+
+		return sel;
+	}
+
+
+	inline void select(
+		const seed::Selector& sel,
+		const std::vector<seed::node_t>& roots,
+		const seed::AST& tree,
+		std::vector<seed::node_t>& out
+	) {
+		if (sel.op.empty()) {
+			const auto& path = sel.path;
+
+			if (path[0] >= roots.size())
+				return;
+
+			seed::node_t n = roots[path[0]];
+
+			for (auto it = path.begin() + 1; it != path.end(); ++it) {
+				const auto* l = std::get_if<List>(&tree[n]);
+
+				if (l == nullptr or *it >= l->children.size())
+					return;
+
+				n = l->children[*it];
+			}
+
+			out.emplace_back(n);
+			return;
+		}
+
+		std::vector<seed::node_t> stack(roots.rbegin(), roots.rend());
+
+		while (not stack.empty()) {
+			seed::node_t n = stack.back();
+			stack.pop_back();
+
+			const auto* l = std::get_if<List>(&tree[n]);
+
+			if (l == nullptr)
+				continue;
+
+			if (l->op.view.length == static_cast<int>(sel.op.size()) and
+				std::equal(sel.op.begin(), sel.op.end(), l->op.view.begin))
+			{
+				out.emplace_back(n);
+				continue;
+			}
+
+			stack.insert(stack.end(), l->children.rbegin(), l->children.rend());
+		}
+	}
+
+
+	// Writes views of a source buffer to a file descriptor, each followed by
+	// a newline, without copying them. Small views are gathered for `writev`,
+	// large ones are copied in-kernel with `copy_file_range` when both ends
+	// are regular files.
+	class SpanWriter {
+		private:
+			static constexpr size_t max_iov = 1024;
+			static constexpr size_t copy_threshold = 64 * 1024;
+
+			int fd = -1;
+			int src_fd = -1;
+			const char* base = nullptr;
+
+			std::vector<iovec> pending;
+
+
+		private:
+			void push(const char* ptr, size_t length) {
+				pending.push_back(iovec{ const_cast<char*>(ptr), length });
+
+				if (pending.size() == max_iov)
+					flush();
+			}
+
+			bool copy(seed::View v) {
+				if (src_fd == -1)
+					return false;
+
+				flush();
+
+				loff_t offset = v.begin - base;
+				size_t left = static_cast<size_t>(v.length);
+
+				while (left != 0) {
+					ssize_t n = ::copy_file_range(src_fd, &offset, fd, nullptr, left, 0);
+
+					if (n <= 0) {
+						if (left != static_cast<size_t>(v.length))
+							error("copy_file_range: ", std::strerror(errno));
+
+						// Not supported between these files, don't try again.
+						::close(src_fd);
+						src_fd = -1;
+						return false;
+					}
+
+					left -= static_cast<size_t>(n);
+				}
+
+				return true;
+			}
+
+
+		public:
+			SpanWriter(int fd_, const std::string& src_path, const char* base_): fd(fd_), base(base_) {
+				struct stat st;
+
+				if (::fstat(fd, &st) == 0 and S_ISREG(st.st_mode) and not (::fcntl(fd, F_GETFL) & O_APPEND))
+					src_fd = ::open(src_path.c_str(), O_RDONLY | O_CLOEXEC);
+			}
+
+			~SpanWriter() {
+				flush();
+
+				if (src_fd != -1)
+					::close(src_fd);
+			}
+
+			SpanWriter(const SpanWriter&) = delete;
+			SpanWriter& operator=(const SpanWriter&) = delete;
+
+
+		public:
+			void write(seed::View v) {
+				if (static_cast<size_t>(v.length) < copy_threshold or not copy(v))
+					push(v.begin, static_cast<size_t>(v.length));
+
+				push("\n", 1);
+			}
+
+			void flush() {
+				iovec* iov = pending.data();
+				size_t left = pending.size();
+
+				while (left != 0) {
+					ssize_t n = ::writev(fd, iov, static_cast<int>(left));
+
+					if (n < 0) {
+						if (errno == EINTR)
+							continue;
+
+						error("write: ", std::strerror(errno));
+					}
+
+					auto written = static_cast<size_t>(n);
+
+					while (left != 0 and written >= iov->iov_len) {
+						written -= iov->iov_len;
+						++iov, --left;
+					}
+
+					if (left != 0) {
+						iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+						iov->iov_len -= written;
+					}
+				}
+
+				pending.clear();
+			}
+	};
+
+
+	inline void extract_file(const std::string& fname, const std::vector<seed::Selector>& selectors, bool partial) {
+		auto src = seed::read_file(fname);
+
+		seed::AST tree;
+		auto roots = seed::parse_file(fname, src, tree, partial);
+
+		std::vector<seed::node_t> selected;
+
+		for (const auto& sel: selectors) {
+			seed::select(sel, roots, tree, selected);
+		}
+
+		seed::SpanWriter writer{STDOUT_FILENO, fname, src.data()};
+
+		for (seed::node_t n: selected) {
+			writer.write(seed::span(tree, n));
+		}
+	}
+}
+
+
+namespace seed {
+	inline std::string_view label(const seed::Token& tok) {
+		return { tok.view.begin, static_cast<size_t>(tok.view.length) };
+	}
+
+
+	// Rewrite rules loaded from a file of `(rule PATTERN TEMPLATE)` forms,
+	// applied bottom up in a single pass before rendering.
+	//
+	// In patterns `?x` matches any node, `?xs...` matches the remaining
+	// children of a list, `_` matches anything without binding and every
+	// other label matches itself. Templates build a new node from literals
+	// and bindings, `?xs...` splices its children into a list. Rules are
+	// dispatched on the operator of their pattern which must be a label.
+	//
+	//   (rule (begin ?x) ?x)
+	//   (rule (progn ?body...) (begin ?body...))
+	class Rules {
+		private:
+			struct Binding {
+				std::string_view name;
+				std::vector<seed::node_t> nodes;
+				size_t uses = 0;  // by the template being instantiated.
+			};
+
+			using Bindings = std::vector<Binding>;
+
+			struct Rule {
+				seed::node_t pattern, templ;
+			};
+
+			std::string src;
+			seed::AST rules;
+			std::unordered_map<std::string_view, std::vector<Rule>> dispatch;
+
+			uint64_t digest = 0;
+
+
+		private:
+			static bool is_variable(std::string_view name) {
+				return name.size() > 1 and name[0] == '?';
+			}
+
+			static bool is_rest(std::string_view name) {
+				return is_variable(name) and name.size() > 4 and name.substr(name.size() - 3) == "...";
+			}
+
+			static const seed::Identifer* variable(const seed::AST& tree, seed::node_t n) {
+				const auto* x = std::get_if<Identifer>(&tree[n]);
+				return x != nullptr and is_variable(label(x->tok)) ? x : nullptr;
+			}
+
+			static bool equal(const seed::AST& tree, seed::node_t a, seed::node_t b) {
+				const auto& x = tree[a];
+				const auto& y = tree[b];
+
+				if (x.index() != y.index())
+					return false;
+
+				return seed::visit(x,
+					[&] (const List& l) {
+						const auto& r = std::get<List>(y);
+
+						if (label(l.op) != label(r.op) or l.children.size() != r.children.size())
+							return false;
+
+						for (size_t i = 0; i != l.children.size(); ++i) {
+							if (not equal(tree, l.children[i], r.children[i]))
+								return false;
+						}
+
+						return true;
+					},
+
+					[&] (const Identifer& l) { return label(l.tok) == label(std::get<Identifer>(y).tok); },
+					[&] (const String& l) { return label(l.tok) == label(std::get<String>(y).tok); },
+					[&] (const Empty&) { return true; }
+				);
+			}
+
+			// A variable that is used twice must match equal subtrees.
+			static bool bind(const seed::AST& tree, Bindings& bindings, std::string_view name, std::vector<seed::node_t> nodes) {
+				for (const auto& b: bindings) {
+					if (b.name != name)
+						continue;
+
+					if (b.nodes.size() != nodes.size())
+						return false;
+
+					for (size_t i = 0; i != nodes.size(); ++i) {
+						if (not equal(tree, b.nodes[i], nodes[i]))
+							return false;
+					}
+
+					return true;
+				}
+
+				bindings.push_back({ name, std::move(nodes) });
+				return true;
+			}
+
+			bool match(seed::node_t p, const seed::AST& tree, seed::node_t n, Bindings& bindings) const {
+				if (const auto* var = variable(rules, p))
+					return bind(tree, bindings, label(var->tok), { n });
+
+				return seed::visit(rules[p],
+					[&] (const List& pl) {
+						const auto* l = std::get_if<List>(&tree[n]);
+
+						if (l == nullptr or label(pl.op) != label(l->op))
+							return false;
+
+						const auto& pc = pl.children;
+						const auto& c = l->children;
+
+						const auto* rest = pc.empty() ? nullptr : variable(rules, pc.back());
+						size_t fixed = rest != nullptr and is_rest(label(rest->tok)) ? pc.size() - 1 : pc.size();
+
+						if (fixed == pc.size() ? c.size() != fixed : c.size() < fixed)
+							return false;
+
+						for (size_t i = 0; i != fixed; ++i) {
+							if (not match(pc[i], tree, c[i], bindings))
+								return false;
+						}
+
+						if (fixed != pc.size())
+							return bind(tree, bindings, label(rest->tok), { c.begin() + fixed, c.end() });
+
+						return true;
+					},
+
+					[&] (const Identifer& px) {
+						const auto* x = std::get_if<Identifer>(&tree[n]);
+						return label(px.tok) == "_" or (x != nullptr and label(x->tok) == label(px.tok));
+					},
+
+					[&] (const String& px) {
+						const auto* x = std::get_if<String>(&tree[n]);
+						return x != nullptr and label(x->tok) == label(px.tok);
+					},
+
+					[&] (const Empty&) {
+						return std::holds_alternative<Empty>(tree[n]);
+					}
+				);
+			}
+
+			Binding* find(Bindings& bindings, std::string_view name) const {
+				for (auto& b: bindings) {
+					if (b.name == name)
+						return &b;
+				}
+
+				return nullptr;
+			}
+
+			static seed::node_t copy(seed::AST& tree, seed::node_t n) {
+				auto node = tree[n];
+
+				if (auto* l = std::get_if<List>(&node)) {
+					for (auto& child: l->children) {
+						child = copy(tree, child);
+					}
+				}
+
+				tree.emplace_back(std::move(node));
+				return static_cast<seed::node_t>(tree.size() - 1);
+			}
+
+			// The bound nodes themselves the first time, copies after that
+			// so a variable used twice doesn't turn the tree into a DAG.
+			static std::vector<seed::node_t> use(seed::AST& tree, Binding& b) {
+				if (b.uses++ == 0)
+					return b.nodes;
+
+				std::vector<seed::node_t> nodes;
+
+				for (seed::node_t n: b.nodes) {
+					nodes.emplace_back(copy(tree, n));
+				}
+
+				return nodes;
+			}
+
+			seed::node_t instantiate(seed::node_t t, seed::AST& tree, Bindings& bindings) const {
+				if (const auto* var = variable(rules, t)) {
+					auto* b = find(bindings, label(var->tok));
+
+					if (b == nullptr or b->nodes.size() != 1)
+						error("rule uses unbound or spliced variable `", var->tok, "` outside of a list.");
+
+					return use(tree, *b)[0];
+				}
+
+				return seed::visit(rules[t],
+					[&] (const List& l) {
+						std::vector<seed::node_t> children;
+
+						for (seed::node_t child: l.children) {
+							const auto* var = variable(rules, child);
+
+							if (var != nullptr and is_rest(label(var->tok))) {
+								auto* b = find(bindings, label(var->tok));
+
+								if (b == nullptr)
+									error("rule uses unbound variable `", var->tok, "`.");
+
+								auto nodes = use(tree, *b);
+								children.insert(children.end(), nodes.begin(), nodes.end());
+							}
+
+							else {
+								children.emplace_back(instantiate(child, tree, bindings));
+							}
+						}
+
+						seed::Token op = l.op;
+
+						// The operator can come from a bound leaf.
+						if (is_variable(label(op))) {
+							const auto* b = find(bindings, label(op));
+
+							if (b == nullptr or b->nodes.size() != 1)
+								error("rule uses unbound variable `", op, "` as an operator.");
+
+							seed::visit(tree[b->nodes[0]],
+								[&] (const List& x) { op = x.op; },
+								[&] (const Identifer& x) { op = x.tok; },
+								[&] (const String& x) { op = x.tok; },
+								[&] (const Empty&) { error("rule uses empty list `", l.op, "` as an operator."); }
+							);
+						}
+
+						return tree.add<List>(op, children);
+					},
+
+					[&] (const Identifer& x) { return tree.add<Identifer>(x.tok); },
+					[&] (const String& x) { return tree.add<String>(x.tok); },
+					[&] (const Empty&) { return tree.add<Empty>(); }
+				);
+			}
+
+
+		public:
+			Rules(const std::string& fname): src(seed::read_file(fname)), digest(hash_bytes(src)) {
+				auto roots = seed::parse_file(fname, src, rules, false);
+
+				for (seed::node_t root: roots) {
+					const auto* r = std::get_if<List>(&rules[root]);
+
+					if (r == nullptr or label(r->op) != "rule" or r->children.size() != 2)
+						error(fname, ": expected `(rule PATTERN TEMPLATE)`, found `", seed::span(rules, root), "`.");
+
+					const auto* head = std::get_if<List>(&rules[r->children[0]]);
+
+					if (head == nullptr or is_variable(label(head->op)) or label(head->op) == "_")
+						error(fname, ": pattern `", seed::span(rules, r->children[0]), "` must be a list with a fixed operator.");
+
+					dispatch[label(head->op)].push_back({ r->children[0], r->children[1] });
+				}
+			}
+
+			Rules(const Rules&) = delete;
+			Rules& operator=(const Rules&) = delete;
+
+
+		public:
+			uint64_t hash() const {
+				return digest;
+			}
+
+			// Rewrite the subtree at `n` in place, children first. The first
+			// rule that matches a node replaces it and its result is not
+			// rewritten again. Returns the node that replaces `n`.
+			seed::node_t rewrite(seed::AST& tree, seed::node_t n) const {
+				if (not std::holds_alternative<List>(tree[n]))
+					return n;
+
+				size_t count = std::get<List>(tree[n]).children.size();
+
+				// Templates add nodes so the list is looked up again every time.
+				for (size_t i = 0; i != count; ++i) {
+					seed::node_t child = rewrite(tree, std::get<List>(tree[n]).children[i]);
+					std::get<List>(tree[n]).children[i] = child;
+				}
+
+				auto it = dispatch.find(label(std::get<List>(tree[n]).op));
+
+				if (it == dispatch.end())
+					return n;
+
+				Bindings bindings;
+
+				for (const auto& rule: it->second) {
+					bindings.clear();
+
+					if (not match(rule.pattern, tree, n, bindings))
+						continue;
+
+					seed::View span = std::get<List>(tree[n]).span;
+					seed::node_t out = instantiate(rule.templ, tree, bindings);
+
+					// Built nodes take the source of the node they replace so
+					// rewritten roots can still be cached by their bytes.
+					if (auto* result = std::get_if<List>(&tree[out]); result != nullptr and result->span.begin == nullptr)
+						result->span = span;
+
+					return out;
+				}
+
+				return n;
+			}
+
+			void rewrite(seed::AST& tree, std::vector<seed::node_t>& roots) const {
+				for (auto& root: roots) {
+					root = rewrite(tree, root);
+				}
+			}
+	};
+}
+
+
+namespace seed {
+	using Histogram = std::map<uint64_t, uint64_t>;
+
+
+	// Anonymous description of the shape of a corpus, enough to synthesize
+	// a corpus that looks the same to the lexer, parser and renderer
+	// without leaking any labels.
+	struct Shape {
+		struct Level {
+			Histogram fanout;  // children per list at this depth.
+			uint64_t lists = 0, identifiers = 0, strings = 0, empties = 0;  // kinds of children.
+		};
+
+		uint64_t roots = 0, empty_roots = 0;
+		uint64_t labels_total = 0, labels_repeated = 0;
+		Histogram labels;  // label length.
+		std::vector<Level> levels;
+	};
+
+
+	inline void record_shape(
+		const std::vector<seed::node_t>& roots,
+		const seed::AST& tree,
+		seed::Shape& shape,
+		std::unordered_map<uint64_t, uint64_t>& seen
+	) {
+		auto label = [&] (const seed::View& v) {
+			shape.labels[static_cast<uint64_t>(v.length)]++;
+			shape.labels_total++;
+
+			if (seen[hash_bytes(v.begin, static_cast<size_t>(v.length))]++ != 0)
+				shape.labels_repeated++;
+		};
+
+		std::vector<std::pair<seed::node_t, size_t>> stack;
+
+		for (seed::node_t root: roots) {
+			shape.roots++;
+
+			if (std::holds_alternative<Empty>(tree[root]))
+				shape.empty_roots++;
+
+			stack.emplace_back(root, 0);
+
+			while (not stack.empty()) {
+				auto [n, depth] = stack.back();
+				stack.pop_back();
+
+				const auto* l = std::get_if<List>(&tree[n]);
+
+				if (l == nullptr)
+					continue;
+
+				if (shape.levels.size() <= depth)
+					shape.levels.resize(depth + 1);
+
+				auto& level = shape.levels[depth];
+				level.fanout[l->children.size()]++;
+				label(l->op.view);
+
+				for (seed::node_t child: l->children) {
+					seed::visit(tree[child],
+						[&] (const List&) { level.lists++; stack.emplace_back(child, depth + 1); },
+						[&] (const Identifer& x) { level.identifiers++; label(x.tok.view); },
+						[&] (const String& x) { level.strings++; label(x.tok.view); },
+						[&] (const Empty&) { level.empties++; }
+					);
+				}
+			}
+		}
+	}
+
+
+	inline std::string histogram_str(const seed::Histogram& hist) {
+		std::string str;
+
+		for (const auto& [value, count]: hist) {
+			str += strcat(" (", value, " ", count, ")");
+		}
+
+		return str;
+	}
+
+
+	inline std::string shape_str(const seed::Shape& shape) {
+		std::string str = "(shape\n";
+
+		str += strcat("\t(roots ", shape.roots, " ", shape.empty_roots, ")\n");
+		str += strcat("\t(repeat ", shape.labels_repeated, " ", shape.labels_total, ")\n");
+		str += "\t(labels" + histogram_str(shape.labels) + ")\n";
+
+		for (size_t depth = 0; depth != shape.levels.size(); ++depth) {
+			const auto& level = shape.levels[depth];
+
+			str += strcat(
+				"\t(level ", depth,
+				" (kinds ", level.lists, " ", level.identifiers, " ", level.strings, " ", level.empties, ")",
+				" (fanout", histogram_str(level.fanout), "))\n"
+			);
+		}
+
+		return str + ")\n";
+	}
+
+
+	// Reads back what `shape_str` writes using our own parser.
+	inline seed::Shape read_shape(const std::string& fname) {
+		auto src = seed::read_file(fname);
+
+		seed::AST tree;
+		seed::Lexer lex{src.c_str()};
+		auto roots = seed::parse(lex, tree);
+
+		auto invalid = [&] () {
+			error("file `", fname, "` is not a valid shape profile.");
+		};
+
+		auto list = [&] (seed::node_t n) -> const List& {
+			const auto* l = std::get_if<List>(&tree[n]);
+
+			if (l == nullptr)
+				invalid();
+
+			return *l;
+		};
+
+		auto to_number = [&] (const seed::Token& tok) -> uint64_t {
+			auto str = tok.str();
+
+			if (tok != TOKEN_IDENTIFIER or str.empty() or str.find_first_not_of("0123456789") != std::string::npos)
+				invalid();
+
+			return std::strtoull(str.c_str(), nullptr, 10);
+		};
+
+		auto number = [&] (seed::node_t n) -> uint64_t {
+			const auto* x = std::get_if<Identifer>(&tree[n]);
+
+			if (x == nullptr)
+				invalid();
+
+			return to_number(x->tok);
+		};
+
+		auto numbers = [&] (const List& l, size_t n) {
+			if (l.children.size() != n)
+				invalid();
+
+			std::vector<uint64_t> values;
+
+			for (seed::node_t child: l.children) {
+				values.emplace_back(number(child));
+			}
+
+			return values;
+		};
+
+		// Pairs are written as `(value count)`.
+		auto histogram = [&] (const List& l) {
+			seed::Histogram hist;
+
+			for (seed::node_t child: l.children) {
+				const auto& pair = list(child);
+				hist[to_number(pair.op)] += numbers(pair, 1)[0];
+			}
+
+			return hist;
+		};
+
+		if (roots.size() != 1 or list(roots[0]).op.str() != "shape")
+			invalid();
+
+		seed::Shape shape;
+
+		for (seed::node_t child: list(roots[0]).children) {
+			const auto& l = list(child);
+			const auto op = l.op.str();
+
+			if (op == "roots") {
+				auto v = numbers(l, 2);
+				shape.roots = v[0], shape.empty_roots = v[1];
+			}
+
+			else if (op == "repeat") {
+				auto v = numbers(l, 2);
+				shape.labels_repeated = v[0], shape.labels_total = v[1];
+			}
+
+			else if (op == "labels") {
+				shape.labels = histogram(l);
+			}
+
+			else if (op == "level" and l.children.size() == 3) {
+				auto depth = number(l.children[0]);
+				const auto& kinds = list(l.children[1]);
+				const auto& fanout = list(l.children[2]);
+
+				if (kinds.op.str() != "kinds" or fanout.op.str() != "fanout" or depth > (1u << 16))
+					invalid();
+
+				if (shape.levels.size() <= depth)
+					shape.levels.resize(depth + 1);
+
+				auto& level = shape.levels[depth];
+				auto v = numbers(kinds, 4);
+
+				level.lists = v[0], level.identifiers = v[1], level.strings = v[2], level.empties = v[3];
+				level.fanout = histogram(fanout);
+			}
+
+			else {
+				invalid();
+			}
+		}
+
+		return shape;
+	}
+}
+
+
+namespace seed {
+	// splitmix64, deterministic across platforms unlike <random> distributions.
+	struct Random {
+		uint64_t state = 0;
+
+		Random(uint64_t seed_): state(seed_) {}
+
+		uint64_t next() {
+			uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			return z ^ (z >> 31);
+		}
+
+		uint64_t below(uint64_t n) {
+			return n == 0 ? 0 : next() % n;
+		}
+
+		uint64_t sample(const seed::Histogram& hist, uint64_t fallback = 0) {
+			uint64_t total = 0;
+
+			for (const auto& [value, count]: hist) {
+				total += count;
+			}
+
+			if (total == 0)
+				return fallback;
+
+			uint64_t r = below(total);
+
+			for (const auto& [value, count]: hist) {
+				if (r < count)
+					return value;
+
+				r -= count;
+			}
+
+			return fallback;
+		}
+	};
+
+
+	// Synthesizes a corpus following the distributions of a shape profile,
+	// one root per line.
+	inline void generate(const seed::Shape& shape, uint64_t roots, uint64_t rng_seed, std::ostream& os) {
+		static constexpr const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789_-";
+		static constexpr int attempts = 8;
+
+		seed::Random rng{rng_seed};
+
+		// The length of every label is drawn first so the histogram comes
+		// out the same. The label is then new with the profile's odds of a
+		// label not being seen before, otherwise one already emitted with
+		// that length is reused, so the measured repetition rate comes out
+		// the same too. A new label that collides with an old one gets a
+		// few more tries before it is counted as a repeat, short lengths
+		// have few distinct labels.
+		uint64_t distinct = shape.labels_total - shape.labels_repeated;
+
+		struct Pool {
+			std::vector<std::string> emitted;
+			std::unordered_map<uint64_t, size_t> seen;  // hash to index in `emitted`.
+		};
+
+		std::unordered_map<uint64_t, Pool> pools;  // by length.
+
+		auto label = [&] () -> const std::string& {
+			uint64_t length = std::max<uint64_t>(1, rng.sample(shape.labels, 1));
+			auto& [emitted, seen] = pools[length];
+
+			if (not emitted.empty() and rng.below(shape.labels_total) >= distinct)
+				return emitted[rng.below(emitted.size())];
+
+			std::string str(length, '\0');
+
+			for (int i = 0; i != attempts; ++i) {
+				for (auto& chr: str) {
+					chr = alphabet[rng.below(sizeof(alphabet) - 1)];
+				}
+
+				auto [it, fresh] = seen.try_emplace(hash_bytes(str), emitted.size());
+
+				if (fresh) {
+					emitted.emplace_back(std::move(str));
+					return emitted.back();
+				}
+
+				if (i == attempts - 1)
+					return emitted[it->second];
+			}
+
+			return emitted.back();
+		};
+
+		std::string out;
+
+		// Kinds of children are drawn from the level of their parent, lists
+		// deeper than the profile goes become identifiers.
+		auto list = [&] (auto& self, size_t depth) -> void {
+			const auto& level = shape.levels[depth];
+
+			out += '(';
+			out += label();
+
+			uint64_t fanout = rng.sample(level.fanout);
+			uint64_t kinds = level.lists + level.identifiers + level.strings + level.empties;
+
+			for (uint64_t i = 0; i != fanout; ++i) {
+				uint64_t r = rng.below(kinds);
+				out += ' ';
+
+				if (r < level.lists and depth + 1 < shape.levels.size())
+					self(self, depth + 1);
+
+				else if (r < level.lists + level.identifiers or r < level.lists)
+					out += label();
+
+				else if (r < level.lists + level.identifiers + level.strings)
+					out += '"' + label() + '"';
+
+				else
+					out += "()";
+			}
+
+			out += ')';
+		};
+
+		for (uint64_t i = 0; i != roots; ++i) {
+			if (shape.levels.empty() or rng.below(shape.roots) < shape.empty_roots)
+				out += "()";
+			else
+				list(list, 0);
+
+			out += '\n';
+
+			if (out.size() > (1u << 20)) {
+				os << out;
+				out.clear();
+			}
+		}
+
+		os << out;
+	}
+}
+
+
+namespace seed {
+	// Order in which nodes are stored in the `AST`. The parser inserts
+	// children before their parents, preorder puts every parent right
+	// before its subtree and van Emde Boas splits each tree at half its
+	// height, recursively, so a root-to-leaf path touches O(log_B n) cache
+	// lines for any block size B.
+	enum class Layout {
+		insertion, preorder, veb,
+	};
+
+
+	inline Layout parse_layout(const std::string& str) {
+		if (str == "insertion") return Layout::insertion;
+		if (str == "preorder") return Layout::preorder;
+		if (str == "veb") return Layout::veb;
+
+		error("unknown layout `", str, "`.");
+	}
+
+
+	inline const std::vector<seed::node_t>* children(const seed::AST& tree, seed::node_t n) {
+		const auto* l = std::get_if<List>(&tree[n]);
+		return l == nullptr ? nullptr : &l->children;
+	}
+
+
+	inline std::vector<seed::node_t> preorder(const std::vector<seed::node_t>& roots, const seed::AST& tree) {
+		std::vector<seed::node_t> order;
+		std::vector<seed::node_t> stack(roots.rbegin(), roots.rend());
+
+		order.reserve(tree.size());
+
+		while (not stack.empty()) {
+			seed::node_t n = stack.back();
+			stack.pop_back();
+
+			order.emplace_back(n);
+
+			if (const auto* c = children(tree, n))
+				stack.insert(stack.end(), c->rbegin(), c->rend());
+		}
+
+		return order;
+	}
+
+
+	inline std::vector<seed::node_t> veb_order(const std::vector<seed::node_t>& roots, const seed::AST& tree) {
+		std::vector<int> height(tree.size(), 1);
+
+		// Children are not guaranteed to come before their parents once a
+		// tree has been laid out, so heights are taken in reverse preorder.
+		auto pre = preorder(roots, tree);
+
+		for (auto it = pre.rbegin(); it != pre.rend(); ++it) {
+			if (const auto* c = children(tree, *it)) {
+				for (seed::node_t child: *c) {
+					height[*it] = std::max(height[*it], height[child] + 1);
+				}
+			}
+		}
+
+		std::vector<seed::node_t> order;
+		std::vector<std::pair<seed::node_t, int>> stack;
+		order.reserve(tree.size());
+
+		// Lay out the top `levels` levels of the subtree at `n`.
+		auto layout = [&] (auto& self, seed::node_t n, int levels) -> void {
+			if (levels == 1 or height[n] == 1) {
+				order.emplace_back(n);
+				return;
+			}
+
+			int top = levels / 2;
+			self(self, n, top);
+
+			// Every node `top` levels below `n` starts a bottom tree.
+			stack.emplace_back(n, 0);
+
+			std::vector<seed::node_t> bottoms;
+
+			while (not stack.empty()) {
+				auto [m, depth] = stack.back();
+				stack.pop_back();
+
+				if (depth == top) {
+					bottoms.emplace_back(m);
+					continue;
+				}
+
+				if (const auto* c = children(tree, m)) {
+					for (auto it = c->rbegin(); it != c->rend(); ++it) {
+						stack.emplace_back(*it, depth + 1);
+					}
+				}
+			}
+
+			for (seed::node_t m: bottoms) {
+				self(self, m, levels - top);
+			}
+		};
+
+		for (seed::node_t root: roots) {
+			layout(layout, root, height[root]);
+		}
+
+		return order;
+	}
+
+
+	// Rebuild `tree` with its nodes stored in `order`, nodes that are not
+	// reachable from `roots` are dropped.
+	inline void relayout(std::vector<seed::node_t>& roots, seed::AST& tree, Layout layout) {
+		if (layout == Layout::insertion)
+			return;
+
+		auto order = layout == Layout::veb ? veb_order(roots, tree) : preorder(roots, tree);
+
+		std::vector<seed::node_t> index(tree.size(), -1);
+
+		for (size_t i = 0; i != order.size(); ++i) {
+			index[order[i]] = static_cast<seed::node_t>(i);
+		}
+
+		seed::AST out;
+		out.reserve(order.size());
+
+		// Copied rather than moved so that the children of each list are
+		// also reallocated in the new order.
+		for (seed::node_t n: order) {
+			out.emplace_back(tree[n]);
+
+			if (auto* l = std::get_if<List>(&out.back())) {
+				for (auto& child: l->children) {
+					child = index[child];
+				}
+			}
+		}
+
+		for (auto& root: roots) {
+			root = index[root];
+		}
+
+		tree = std::move(out);
+	}
+
+
+	// Compares layouts on random root-to-leaf walks and a full render.
+	inline void bench_layouts(const std::string& src, std::ostream& os) {
+		using clock = std::chrono::steady_clock;
+		static constexpr size_t walks = 1 << 20;
+
+		auto ms = [] (clock::duration d) {
+			return std::chrono::duration<double, std::milli>(d).count();
+		};
+
+		os << "layout      relayout(ms)  walks(ms)  render(ms)\n";
+
+		for (Layout layout: { Layout::insertion, Layout::preorder, Layout::veb }) {
+			seed::AST tree;
+			seed::Lexer lex{src.c_str()};
+			auto roots = seed::parse(lex, tree);
+
+			if (roots.empty())
+				return;
+
+			auto t0 = clock::now();
+			relayout(roots, tree, layout);
+
+			auto t1 = clock::now();
+			seed::Random rng{1};
+			uint64_t sink = 0;
+
+			for (size_t i = 0; i != walks; ++i) {
+				seed::node_t n = roots[rng.below(roots.size())];
+
+				while (const auto* c = children(tree, n)) {
+					sink += std::get<List>(tree[n]).op.view.length;
+
+					if (c->empty())
+						break;
+
+					n = (*c)[rng.below(c->size())];
+				}
+			}
+
+			auto t2 = clock::now();
+			sink += seed::render(roots, tree).size();
+			auto t3 = clock::now();
+
+			const char* names[] = { "insertion", "preorder", "veb" };
+
+			os << std::left << std::setw(12) << names[static_cast<int>(layout)]
+				<< std::setw(14) << ms(t1 - t0)
+				<< std::setw(11) << ms(t2 - t1)
+				<< ms(t3 - t2)
+				<< (sink == 0 ? " " : "") << '\n';
+		}
+	}
+}
+
+
+namespace seed {
+	constexpr uint64_t mix(uint64_t h, uint64_t x) {
+		h ^= x + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+		h = (h ^ (h >> 31)) * 0xbf58476d1ce4e5b9ull;
+		return h ^ (h >> 29);
+	}
+
+
+	// Structural hash, node count and source size of every subtree
+	// reachable from `roots`, indexed like the tree.
+	struct Subtrees {
+		std::vector<uint64_t> hash;
+		std::vector<uint32_t> nodes;
+		std::vector<uint32_t> bytes;
+	};
+
+
+	inline uint64_t label_hash(const seed::View& v) {
+		return hash_bytes(v.begin, static_cast<size_t>(v.length));
+	}
+
+
+	// Kind and label of a single node, its children left out.
+	inline uint64_t node_hash(const seed::AST& tree, seed::node_t n) {
+		return seed::visit(tree[n],
+			[] (const List& l) { return mix(1, label_hash(l.op.view)); },
+			[] (const Identifer& x) { return mix(2, label_hash(x.tok.view)); },
+			[] (const String& x) { return mix(3, label_hash(x.tok.view)); },
+			[] (const Empty&) { return mix(4, 0); }
+		);
+	}
+
+
+	// An input of a report.
+	struct Parsed {
+		std::string src;
+		seed::AST tree;
+	};
+
+
+	// `file:line:column` of reported subtrees, line indices are only built
+	// for the files that show up.
+	class Locations {
+		private:
+			const std::vector<std::string>& files;
+			std::vector<std::unique_ptr<seed::LineIndex>> lines;
+
+
+		public:
+			Locations(const std::vector<std::string>& files_): files(files_), lines(files.size()) {}
+
+			std::string operator()(size_t file, const Parsed& p, seed::node_t n) {
+				auto& index = lines[file];
+
+				if (index == nullptr)
+					index = std::make_unique<seed::LineIndex>(p.src.data(), p.src.data() + p.src.size());
+
+				return strcat(files[file], ":", index->position(seed::span(p.tree, n).begin));
+			}
+	};
+
+
+	// Source of a subtree on one line, cut to fit a report.
+	inline std::string excerpt(const seed::AST& tree, seed::node_t n) {
+		auto str = seed::span(tree, n).str();
+		std::replace_if(str.begin(), str.end(), seed::is_whitespace, ' ');
+
+		if (str.size() > 72)
+			str = str.substr(0, 69) + "...";
+
+		return str;
+	}
+
+
+	// Roots are independent so they are split between workers, every node
+	// is written by exactly one of them.
+	inline seed::Subtrees hash_subtrees(const std::vector<seed::node_t>& roots, const seed::AST& tree, unsigned jobs) {
+		seed::Subtrees sub;
+		sub.hash.resize(tree.size());
+		sub.nodes.resize(tree.size());
+		sub.bytes.resize(tree.size());
+
+		std::atomic<size_t> next{0};
+
+		seed::parallel(std::min<size_t>(jobs, roots.size()), [&] {
+			std::vector<std::pair<seed::node_t, bool>> stack;
+
+			for (size_t i; (i = next++) < roots.size();) {
+				stack.emplace_back(roots[i], false);
+
+				while (not stack.empty()) {
+					auto [n, visited] = stack.back();
+					stack.pop_back();
+
+					const auto* l = std::get_if<List>(&tree[n]);
+
+					if (l != nullptr and not visited) {
+						stack.emplace_back(n, true);
+
+						for (seed::node_t child: l->children) {
+							stack.emplace_back(child, false);
+						}
+
+						continue;
+					}
+
+					sub.bytes[n] = static_cast<uint32_t>(seed::span(tree, n).length);
+					sub.nodes[n] = 1;
+
+					uint64_t h = node_hash(tree, n);
+
+					if (l != nullptr) {
+						for (seed::node_t child: l->children) {
+							h = mix(h, sub.hash[child]);
+							sub.nodes[n] += sub.nodes[child];
+						}
+					}
+
+					sub.hash[n] = h;
+				}
+			}
+		});
+
+		return sub;
+	}
+
+
+	// Repeated subtrees across a set of files, ranked by how many bytes
+	// all but one of their copies take up.
+	inline void dupes(
+		const std::vector<std::string>& files,
+		bool partial,
+		unsigned jobs,
+		size_t top,
+		std::ostream& os
+	) {
+		struct File: Parsed {
+			std::vector<seed::node_t> roots;
+			seed::Subtrees sub;
+		};
+
+		struct Copy {
+			uint64_t hash;
+			uint32_t file;
+			seed::node_t node;
+		};
+
+		std::vector<File> parsed(files.size());
+		std::vector<Copy> copies;
+
+		for (size_t i = 0; i != files.size(); ++i) {
+			auto& f = parsed[i];
+
+			f.src = seed::read_file(files[i]);
+			f.roots = seed::parse_file(files[i], f.src, f.tree, partial);
+			f.sub = hash_subtrees(f.roots, f.tree, jobs);
+
+			// Leaves are too small to be interesting on their own.
+			for (size_t n = 0; n != f.tree.size(); ++n) {
+				if (f.sub.nodes[n] > 1)
+					copies.push_back({ f.sub.hash[n], static_cast<uint32_t>(i), static_cast<seed::node_t>(n) });
+			}
+		}
+
+		std::sort(copies.begin(), copies.end(), [] (const Copy& a, const Copy& b) {
+			return std::tie(a.hash, a.file, a.node) < std::tie(b.hash, b.file, b.node);
+		});
+
+		struct Group {
+			size_t begin, count;
+			uint64_t nodes, bytes;
+		};
+
+		std::vector<Group> groups;
+
+		for (size_t i = 0, j; i != copies.size(); i = j) {
+			for (j = i + 1; j != copies.size() and copies[j].hash == copies[i].hash; ++j) {}
+
+			if (j - i < 2)
+				continue;
+
+			const auto& sub = parsed[copies[i].file].sub;
+			groups.push_back({ i, j - i, sub.nodes[copies[i].node], sub.bytes[copies[i].node] });
+		}
+
+		auto wasted = [] (const Group& g) {
+			return (g.count - 1) * g.bytes;
+		};
+
+		top = std::min(top, groups.size());
+
+		std::partial_sort(groups.begin(), groups.begin() + top, groups.end(), [&] (const Group& a, const Group& b) {
+			return wasted(a) > wasted(b);
+		});
+
+		seed::Locations location{files};
+
+		os << "rank  count  nodes  bytes  wasted-nodes  wasted-bytes  locations\n";
+
+		for (size_t i = 0; i != top; ++i) {
+			const auto& g = groups[i];
+			const auto& first = copies[g.begin];
+
+			os << std::left
+				<< std::setw(6) << i + 1
+				<< std::setw(7) << g.count
+				<< std::setw(7) << g.nodes
+				<< std::setw(7) << g.bytes
+				<< std::setw(14) << (g.count - 1) * g.nodes
+				<< std::setw(14) << wasted(g);
+
+			for (size_t j = 0; j != std::min<size_t>(g.count, 3); ++j) {
+				const auto& c = copies[g.begin + j];
+				os << (j ? " " : "") << location(c.file, parsed[c.file], c.node);
+			}
+
+			os << "\n      " << excerpt(parsed[first.file].tree, first.node) << '\n';
+		}
+	}
+}
+
+
+namespace seed {
+	// Near-duplicate roots. Each root becomes a set of shingles, its head
+	// operators paired with the labels of their children, alone and in
+	// pairs. A MinHash signature of that set estimates the Jaccard
+	// similarity between two roots, and locality sensitive hashing puts
+	// roots whose signatures agree on a whole band in the same bucket so
+	// only those are ever compared.
+	class Similarity {
+		public:
+			static constexpr size_t bands = 16;
+			static constexpr size_t rows = 4;
+			static constexpr size_t hashes = bands * rows;
+
+			using Signature = std::array<uint64_t, hashes>;
+
+
+		public:
+			static std::vector<uint64_t> shingles(const seed::AST& tree, seed::node_t root) {
+				std::vector<uint64_t> out;
+				std::vector<seed::node_t> stack{ root };
+
+				while (not stack.empty()) {
+					seed::node_t n = stack.back();
+					stack.pop_back();
+
+					const auto* l = std::get_if<List>(&tree[n]);
+
+					if (l == nullptr)
+						continue;
+
+					uint64_t head = mix(5, label_hash(l->op.view));
+					out.emplace_back(head);
+
+					uint64_t prev = 0;
+
+					for (seed::node_t child: l->children) {
+						uint64_t label = node_hash(tree, child);
+
+						out.emplace_back(mix(head, label));
+						out.emplace_back(mix(mix(head, prev), label));
+
+						prev = label;
+						stack.emplace_back(child);
+					}
+				}
+
+				std::sort(out.begin(), out.end());
+				out.erase(std::unique(out.begin(), out.end()), out.end());
+
+				return out;
+			}
+
+			static Signature signature(const std::vector<uint64_t>& shingles) {
+				Signature sig;
+				sig.fill(std::numeric_limits<uint64_t>::max());
+
+				for (uint64_t sh: shingles) {
+					for (size_t i = 0; i != hashes; ++i) {
+						sig[i] = std::min(sig[i], mix(sh, i + 1));
+					}
+				}
+
+				return sig;
+			}
+
+			static double estimate(const Signature& a, const Signature& b) {
+				size_t same = 0;
+
+				for (size_t i = 0; i != hashes; ++i) {
+					same += a[i] == b[i];
+				}
+
+				return static_cast<double>(same) / hashes;
+			}
+
+			static uint64_t band(const Signature& sig, size_t b) {
+				uint64_t h = mix(6, b);
+
+				for (size_t i = b * rows; i != (b + 1) * rows; ++i) {
+					h = mix(h, sig[i]);
+				}
+
+				return h;
+			}
+	};
+
+
+	// Clusters of near-identical roots across a set of files, largest first.
+	inline void similar(
+		const std::vector<std::string>& files,
+		bool partial,
+		unsigned jobs,
+		size_t top,
+		double threshold,
+		std::ostream& os
+	) {
+		struct Root {
+			uint32_t file;
+			seed::node_t node;
+			Similarity::Signature sig;
+		};
+
+		std::vector<seed::Parsed> parsed(files.size());
+		std::vector<Root> roots;
+
+		for (size_t i = 0; i != files.size(); ++i) {
+			auto& f = parsed[i];
+			f.src = seed::read_file(files[i]);
+
+			for (seed::node_t n: seed::parse_file(files[i], f.src, f.tree, partial)) {
+				if (std::holds_alternative<List>(f.tree[n]))
+					roots.push_back({ static_cast<uint32_t>(i), n, {} });
+			}
+		}
+
+		std::atomic<size_t> next{0};
+
+		seed::parallel(std::min<size_t>(jobs, roots.size()), [&] {
+			for (size_t i; (i = next++) < roots.size();) {
+				auto& r = roots[i];
+				r.sig = Similarity::signature(Similarity::shingles(parsed[r.file].tree, r.node));
+			}
+		});
+
+		// Union-find over roots, only joined after checking the estimate so
+		// an unlucky band collision does not merge unrelated clusters.
+		std::vector<size_t> parent(roots.size());
+
+		for (size_t i = 0; i != parent.size(); ++i) {
+			parent[i] = i;
+		}
+
+		auto find = [&] (size_t x) {
+			while (parent[x] != x) {
+				x = parent[x] = parent[parent[x]];
+			}
+
+			return x;
+		};
+
+		std::vector<std::pair<uint64_t, size_t>> buckets(roots.size());
+
+		for (size_t b = 0; b != Similarity::bands; ++b) {
+			for (size_t i = 0; i != roots.size(); ++i) {
+				buckets[i] = { Similarity::band(roots[i].sig, b), i };
+			}
+
+			std::sort(buckets.begin(), buckets.end());
+
+			// Compare everything in a bucket with its first member.
+			for (size_t i = 0, j; i != buckets.size(); i = j) {
+				size_t a = buckets[i].second;
+
+				for (j = i + 1; j != buckets.size() and buckets[j].first == buckets[i].first; ++j) {
+					size_t c = buckets[j].second;
+
+					if (Similarity::estimate(roots[a].sig, roots[c].sig) >= threshold)
+						parent[find(c)] = find(a);
+				}
+			}
+		}
+
+		std::unordered_map<size_t, std::vector<size_t>> clusters;
+
+		for (size_t i = 0; i != roots.size(); ++i) {
+			clusters[find(i)].emplace_back(i);
+		}
+
+		std::vector<std::vector<size_t>> ranked;
+
+		for (auto& [rep, members]: clusters) {
+			if (members.size() > 1)
+				ranked.emplace_back(std::move(members));
+		}
+
+		std::sort(ranked.begin(), ranked.end(), [] (const auto& a, const auto& b) {
+			return a.size() != b.size() ? a.size() > b.size() : a.front() < b.front();
+		});
+
+		ranked.resize(std::min(top, ranked.size()));
+
+		seed::Locations location{files};
+
+		os << "rank  roots  similarity  locations\n";
+
+		for (size_t i = 0; i != ranked.size(); ++i) {
+			const auto& members = ranked[i];
+			const auto& first = roots[members.front()];
+
+			double sum = 0;
+
+			for (size_t m: members) {
+				sum += Similarity::estimate(first.sig, roots[m].sig);
+			}
+
+			os << std::left
+				<< std::setw(6) << i + 1
+				<< std::setw(7) << members.size()
+				<< std::setw(12) << std::fixed << std::setprecision(2) << (sum - 1) / static_cast<double>(members.size() - 1);
+
+			for (size_t j = 0; j != std::min<size_t>(members.size(), 3); ++j) {
+				const auto& r = roots[members[j]];
+				os << (j ? " " : "") << location(r.file, parsed[r.file], r.node);
+			}
+
+			os << "\n      " << excerpt(parsed[first.file].tree, first.node) << '\n';
+		}
+	}
+}
+
+
+namespace seed {
+	inline std::string json_escape(std::string_view str) {
+		std::string out;
+		out.reserve(str.size());
+
+		for (char chr: str) {
+			switch (chr) {
+				case '"': out += "\\\""; break;
+				case '\\': out += "\\\\"; break;
+				case '\n': out += "\\n"; break;
+				case '\t': out += "\\t"; break;
+
+				default:
+					if (static_cast<unsigned char>(chr) < 0x20) {
+						char buf[8];
+						std::snprintf(buf, sizeof(buf), "\\u%04x", chr);
+						out += buf;
+					}
+
+					else {
+						out += chr;
+					}
+			}
+		}
+
+		return out;
+	}
+
+
+	// Levels of detail of a rendered tree for zoomable viewers. Level 0 is
+	// the full graph, every following level collapses lists whose subtree
+	// has at most `factor` times more nodes than the previous level allowed
+	// into a single summary node.
+	//
+	// Nodes keep the id they have in the full render at every level and
+	// summaries carry the range of ids they cover. Every level is cut into
+	// regions of consecutive roots with the id range they cover, so a
+	// viewer can load a coarse level and fetch only the regions under a
+	// summary from a finer one.
+	class LevelsOfDetail {
+		private:
+			const seed::AST& tree;
+			const std::vector<seed::node_t>& roots;
+
+			std::vector<int> id, end, size;  // per node, as numbered by `render`.
+
+
+		private:
+			void number(seed::node_t n, int& node_counter) {
+				seed::visit(tree[n],
+					[&] (const List& l) {
+						id[n] = node_counter++;
+						size[n] = 1;
+
+						for (seed::node_t child: l.children) {
+							number(child, node_counter);
+							node_counter++;
+							size[n] += size[child];
+						}
+					},
+
+					[&] (const Identifer&) { id[n] = node_counter++; size[n] = 1; },
+					[&] (const String&) { id[n] = node_counter++; size[n] = 1; },
+					[&] (const Empty&) {}
+				);
+
+				end[n] = node_counter;
+			}
+
+			std::string dot_label(seed::node_t n) const {
+				return seed::visit(tree[n],
+					[] (const List& l) { return l.op.str(); },
+					[] (const Identifer& x) { return x.tok.str(); },
+					[] (const Empty&) { return std::string{}; },
+
+					[] (const String& x) {
+						std::string str;
+
+						for (auto chr: x.tok.str()) {
+							if (chr == '"')
+								str += "\\\"";
+							else
+								str += chr;
+						}
+
+						return str;
+					}
+				);
+			}
+
+			std::string json_label(seed::node_t n) const {
+				return seed::visit(tree[n],
+					[] (const List& l) { return json_escape(label(l.op)); },
+					[] (const Identifer& x) { return json_escape(label(x.tok)); },
+					[] (const String& x) { return json_escape(label(x.tok)); },
+					[] (const Empty&) { return std::string{}; }
+				);
+			}
+
+			// Nodes of the subtree at `n` that are drawn at `threshold`.
+			size_t visible(seed::node_t n, int threshold) const {
+				if (std::holds_alternative<Empty>(tree[n]))
+					return 0;
+
+				const auto* l = std::get_if<List>(&tree[n]);
+
+				if (l == nullptr or (size[n] > 1 and size[n] <= threshold))
+					return 1;
+
+				size_t count = 1;
+
+				for (seed::node_t child: l->children) {
+					count += visible(child, threshold);
+				}
+
+				return count;
+			}
+
+			void emit(seed::node_t n, int parent, int threshold, std::string& dot, std::string& json, size_t& count) const {
+				if (std::holds_alternative<Empty>(tree[n]))
+					return;
+
+				const auto* l = std::get_if<List>(&tree[n]);
+				bool summary = l != nullptr and size[n] > 1 and size[n] <= threshold;
+
+				dot += strcat("\t\tn", id[n], " [label=\"", dot_label(n));
+
+				if (summary)
+					dot += strcat(" (", size[n], ")\", shape=box, lod_nodes=", size[n], ", lod_end=", end[n], "];\n");
+				else
+					dot += "\"];\n";
+
+				if (parent != -1)
+					dot += strcat("\t\tn", parent, " -> n", id[n], ";\n");
+
+				json += strcat(
+					count++ ? ",\n\t\t" : "\n\t\t",
+					"{\"id\": ", id[n], ", \"parent\": ", parent,
+					", \"label\": \"", json_label(n), "\"",
+					", \"nodes\": ", size[n], ", \"end\": ", end[n],
+					", \"summary\": ", summary ? "true" : "false", "}"
+				);
+
+				if (l == nullptr or summary)
+					return;
+
+				for (seed::node_t child: l->children) {
+					emit(child, id[n], threshold, dot, json, count);
+				}
+			}
+
+
+		public:
+			LevelsOfDetail(const seed::AST& tree_, const std::vector<seed::node_t>& roots_):
+				tree(tree_), roots(roots_), id(tree.size(), -1), end(tree.size(), 0), size(tree.size(), 0)
+			{
+				int node_counter = 0;
+
+				for (seed::node_t root: roots) {
+					number(root, node_counter);
+					node_counter++;
+				}
+			}
+
+
+		public:
+			struct Region {
+				size_t first = 0, last = 0;  // roots.
+				int begin = 0, end = 0;  // ids.
+				size_t nodes = 0;
+			};
+
+
+		public:
+			// Thresholds of every level, ending with the first one that
+			// collapses every root.
+			std::vector<int> thresholds(int factor) const {
+				int largest = 0;
+
+				for (seed::node_t root: roots) {
+					largest = std::max(largest, size[root]);
+				}
+
+				std::vector<int> out{ 1 };
+
+				while (out.back() < largest and out.back() <= std::numeric_limits<int>::max() / factor) {
+					out.emplace_back(out.back() * factor);
+				}
+
+				return out;
+			}
+
+			// Consecutive roots drawing about `budget` nodes at `threshold`,
+			// a root is never split.
+			std::vector<Region> regions(int threshold, size_t budget) const {
+				std::vector<Region> out;
+				Region region;
+
+				for (size_t i = 0; i != roots.size(); ++i) {
+					region.nodes += visible(roots[i], threshold);
+					region.last = i + 1;
+					region.end = end[roots[i]];
+
+					if (region.nodes >= budget or i + 1 == roots.size()) {
+						out.emplace_back(region);
+						region = { i + 1, i + 1, region.end + 1, region.end + 1, 0 };
+					}
+				}
+
+				return out;
+			}
+
+			// Renders roots `first` to `last` of a level, returns the number
+			// of nodes drawn.
+			size_t level(int threshold, size_t first, size_t last, const std::string& title, std::string& dot, std::string& json) const {
+				size_t count = 0;
+
+				dot = title + " {\n";
+				json = strcat("{\"threshold\": ", threshold, ", \"roots\": [");
+
+				for (size_t i = first; i != last; ++i) {
+					dot += strcat("\tsubgraph cluster", i, " {\n");
+					json += strcat(i != first ? ",\n" : "\n", "\t{\"cluster\": ", i, ", \"nodes\": [");
+
+					size_t before = count;
+					count = 0;
+
+					emit(roots[i], -1, threshold, dot, json, count);
+
+					count += before;
+					dot += "\t}\n";
+					json += "]}";
+				}
+
+				dot += "}\n";
+				json += "\n]}\n";
+
+				return count;
+			}
+	};
+
+
+	// The same relative path as `fname` under `dir`. Absolute paths are made
+	// relative and `..` can not climb out of `dir`.
+	inline std::string mirror_path(const std::string& dir, const std::string& fname) {
+		std::filesystem::path out{dir};
+
+		for (const auto& part: std::filesystem::path{fname}.relative_path().lexically_normal()) {
+			if (part == "..")
+				out /= "__";
+			else if (part != "." and not part.empty())
+				out /= part;
+		}
+
+		return out.string();
+	}
+
+
+	inline void write_file(const std::string& fname, const std::string& str) {
+		std::ofstream os(fname, std::ios::binary | std::ios::trunc);
+		os.write(str.data(), static_cast<std::streamsize>(str.size()));
+
+		if (not os)
+			error("could not write `", fname, "`.");
+	}
+
+
+	// Writes `<dir>/<file>.lod<k>.<r>.dot` and `.json` for every region of
+	// every level, where `<file>` is mirrored like outputs are, and an
+	// index of the levels and their regions in `<dir>/<file>.lod.json`.
+	inline void write_levels(
+		const std::string& fname,
+		const seed::AST& tree,
+		const std::vector<seed::node_t>& roots,
+		const std::string& dir,
+		int factor,
+		const std::string& title
+	) {
+		static constexpr size_t region_nodes = 1 << 14;
+
+		seed::LevelsOfDetail lod{tree, roots};
+
+		const std::string base = mirror_path(dir, fname);
+
+		std::error_code ec;
+		std::filesystem::create_directories(std::filesystem::path{base}.parent_path(), ec);
+
+		std::string index = "{\"levels\": [";
+
+		auto thresholds = lod.thresholds(factor);
+
+		for (size_t k = 0; k != thresholds.size(); ++k) {
+			std::string regions;
+			size_t count = 0;
+
+			auto parts = lod.regions(thresholds[k], region_nodes);
+
+			for (size_t r = 0; r != parts.size(); ++r) {
+				const auto& region = parts[r];
+
+				std::string dot, json;
+				count += lod.level(thresholds[k], region.first, region.last, title, dot, json);
+
+				const std::string name = strcat(base, ".lod", k, ".", r);
+
+				write_file(name + ".dot", dot);
+				write_file(name + ".json", json);
+
+				// Paths in the index are relative to it.
+				const std::string rel = std::filesystem::path{name}.filename().string();
+
+				regions += strcat(
+					r ? ",\n" : "\n",
+					"\t\t{\"begin\": ", region.begin, ", \"end\": ", region.end, ", \"nodes\": ", region.nodes,
+					", \"dot\": \"", json_escape(rel + ".dot"), "\", \"json\": \"", json_escape(rel + ".json"), "\"}"
+				);
+			}
+
+			index += strcat(
+				k ? ",\n" : "\n",
+				"\t{\"level\": ", k, ", \"threshold\": ", thresholds[k], ", \"nodes\": ", count,
+				", \"regions\": [", regions, "\n\t]}"
+			);
+		}
+
+		write_file(base + ".lod.json", index + "\n]}\n");
+	}
+}
+
+
+namespace seed {
+	struct Options {
+		std::vector<std::string> files;
+		std::string title = "digraph";
+		std::string cache;
+		std::vector<seed::Selector> extract;
+		bool record_shape = false;
+		std::string generate;
+		uint64_t generate_roots = 0;
+		uint64_t generate_seed = 1;
+		seed::Layout layout = seed::Layout::insertion;
+		bool bench_layout = false;
+		std::string rules_file;
+		std::shared_ptr<const seed::Rules> rules;
+		std::string output_dir;
+		std::string journal;
+		bool gzip = false;
+		std::string lod;
+		int lod_factor = 8;
+		bool partial = false;
+		bool fused = false;
+		std::string profile_roots;
+		bool show_progress = false;
+		std::string status;
+		bool dupes = false;
+		bool similar = false;
+		double threshold = 0.5;
+		size_t top = 10;
+		unsigned jobs = 0;
+	};
+
+
+	inline void usage() {
+		std::cerr << "usage: seed [options] <file>...\n"
+			"  -j, --jobs <n>    number of worker threads for multiple files.\n"
+			"  -o, --output-dir <dir>\n"
+			"                    write each graph to <dir>/<file>.dot instead of stdout.\n"
+			"  -z, --gzip        compress graphs with gzip, in parallel.\n"
+			"  --journal <file>  record finished inputs and skip them when restarted,\n"
+			"                    requires --output-dir.\n"
+			"  --partial         report syntax errors but still use the valid forms.\n"
+			"  --rules <file>    rewrite the tree with `(rule PATTERN TEMPLATE)` forms\n"
+			"                    before rendering.\n"
+			"  --fused           render while lexing without building a tree, stops\n"
+			"                    at the first syntax error. Printed to stdout, the\n"
+			"                    output before the error is already written.\n"
+			"  --cache <file>    reuse and save rendered outputs in a snapshot file.\n"
+			"  --extract <sel>   print the source of selected forms instead of a graph.\n"
+			"                    <sel> is a root index `3`, a path `3/0/2` or `@op`.\n"
+			"  --record-shape    print an anonymous shape profile of the inputs.\n"
+			"  --generate <file> print a synthetic corpus following a shape profile.\n"
+			"  --roots <n>       number of roots to generate, defaults to the profile's.\n"
+			"  --seed <n>        random seed for --generate.\n"
+			"  --layout <order>  store the tree in `insertion`, `preorder` or `veb` order.\n"
+			"  --bench-layout    time queries and rendering for every layout.\n"
+			"  --lod <dir>       write levels of detail of each graph to <dir>.\n"
+			"  --lod-factor <n>  growth of the collapsed subtree size per level.\n"
+			"  --progress        print throughput and time left to stderr every second.\n"
+			"  --status <file>   keep the same progress line in <file>.\n"
+			"                    SIGUSR1 always prints a progress line to stderr.\n"
+			"  --profile-roots <csv>\n"
+			"                    time parsing and rendering of every root, write them\n"
+			"                    to <csv> and print the most expensive to stderr.\n"
+			"  --dupes           report the most wasteful repeated subtrees.\n"
+			"  --similar         report clusters of near-identical roots.\n"
+			"  --threshold <x>   minimum estimated similarity for --similar, 0.5.\n"
+			"  --top <k>         number of entries in reports, defaults to 10.\n";
+	}
+
+
+	inline Options parse_args(int argc, const char* argv[]) {
+		Options opts;
+		bool only_files = false;
+
+		for (int i = 1; i < argc; ++i) {
+			const std::string arg = argv[i];
+
+			auto value = [&] () -> std::string {
+				if (i + 1 == argc)
+					error("option `", arg, "` expects a value.");
+
+				return argv[++i];
+			};
+
+			if (only_files or arg.empty() or arg[0] != '-')
+				opts.files.emplace_back(arg);
+
+			else if (arg == "--")
+				only_files = true;
+
+			else if (arg == "--partial")
+				opts.partial = true;
+
+			else if (arg == "--fused")
+				opts.fused = true;
+
+			else if (arg == "--rules")
+				opts.rules_file = value();
+
+			else if (arg == "-o" or arg == "--output-dir")
+				opts.output_dir = value();
+
+			else if (arg == "--journal")
+				opts.journal = value();
+
+			else if (arg == "-z" or arg == "--gzip")
+				opts.gzip = true;
+
+			else if (arg == "-j" or arg == "--jobs")
+				opts.jobs = parse_number<unsigned>(value(), "job count");
+
+			else if (arg == "--cache")
+				opts.cache = value();
+
+			else if (arg == "--extract")
+				opts.extract.emplace_back(parse_selector(value()));
+
+			else if (arg == "--record-shape")
+				opts.record_shape = true;
+
+			else if (arg == "--generate")
+				opts.generate = value();
+
+			else if (arg == "--roots")
+				opts.generate_roots = parse_number<uint64_t>(value(), "root count");
+
+			else if (arg == "--seed")
+				opts.generate_seed = parse_number<uint64_t>(value(), "seed");
+
+			else if (arg == "--layout")
+				opts.layout = parse_layout(value());
+
+			else if (arg == "--bench-layout")
+				opts.bench_layout = true;
+
+			else if (arg == "--dupes")
+				opts.dupes = true;
+
+			else if (arg == "--profile-roots")
+				opts.profile_roots = value();
+
+			else if (arg == "--progress")
+				opts.show_progress = true;
+
+			else if (arg == "--status")
+				opts.status = value();
+
+			else if (arg == "--lod")
+				opts.lod = value();
+
+			else if (arg == "--lod-factor")
+				opts.lod_factor = std::max(2, parse_number<int>(value(), "level of detail factor"));
+
+			else if (arg == "--similar")
+				opts.similar = true;
+
+			else if (arg == "--threshold")
+				opts.threshold = parse_number<double>(value(), "threshold");
+
+			else if (arg == "--top")
+				opts.top = parse_number<size_t>(value(), "report size");
+
+			else
+				error("unknown option `", arg, "`.");
+		}
+
+		if (opts.jobs == 0)
+			opts.jobs = std::max(1u, std::thread::hardware_concurrency());
+
+		if (not opts.journal.empty() and opts.output_dir.empty())
+			error("`--journal` needs `--output-dir` to know which outputs exist.");
+
+		if (opts.fused and opts.partial)
+			error("`--fused` stops at the first syntax error, it can't go on with `--partial`.");
+
+		if (opts.fused and not opts.profile_roots.empty())
+			error("`--fused` has no separate parse and render to profile.");
+
+		if (opts.fused and not opts.rules_file.empty())
+			error("`--fused` builds no tree for `--rules` to rewrite.");
+
+		if (not opts.rules_file.empty()) {
+			std::error_code ec;
+
+			if (not std::filesystem::exists(opts.rules_file, ec))
+				error("file `", opts.rules_file, "` does not exist.");
+
+			opts.rules = std::make_shared<const seed::Rules>(opts.rules_file);
+		}
+
+		return opts;
+	}
+
+
+	// Everything that changes the output for a given input.
+	inline uint64_t options_key(const Options& opts) {
+		return mix(hash_bytes(opts.title) ^ opts.partial, opts.rules ? opts.rules->hash() : 0);
+	}
+}
+
+
+namespace seed {
+	// Coalesces concurrent calls with the same key so that only the first
+	// caller computes the value and every other caller waits for it and
+	// shares the same buffer, which `fn` returns already shared. Keys are
+	// forgotten once the computation ends, this is not a cache.
+	template <typename K, typename V, typename H = std::hash<K>>
+	class SingleFlight {
+		private:
+			using result_t = std::shared_ptr<const V>;
+
+			std::mutex mtx;
+			std::unordered_map<K, std::shared_future<result_t>, H> inflight;
+
+
+		public:
+			template <typename F>
+			result_t run(const K& key, F&& fn) {
+				std::unique_lock<std::mutex> lock{mtx};
+
+				if (auto it = inflight.find(key); it != inflight.end()) {
+					auto fut = it->second;
+					lock.unlock();
+					return fut.get();
+				}
+
+				std::promise<result_t> promise;
+				inflight.emplace(key, promise.get_future().share());
+				lock.unlock();
+
+				result_t result = fn();
+				promise.set_value(result);
+
+				lock.lock();
+				inflight.erase(key);
+
+				return result;
+			}
+	};
+
+
+	struct RenderKey {
+		uint64_t hash = 0;
+		size_t length = 0;
+
+		bool operator==(const RenderKey& other) const {
+			return hash == other.hash and length == other.length;
+		}
+	};
+
+	struct RenderKeyHash {
+		size_t operator()(const RenderKey& k) const {
+			return static_cast<size_t>(k.hash ^ k.length);
+		}
+	};
+
+	// An output and whether its input was free of syntax errors, which only
+	// the worker that rendered it reports.
+	struct Rendered {
+		std::shared_ptr<const std::string> out;
+		bool clean = true;
+	};
+
+	using RenderFlight = seed::SingleFlight<RenderKey, Rendered, RenderKeyHash>;
+}
+
+
+namespace seed {
+	// Snapshot of rendered outputs that survives between runs. The file is
+	// mapped read-only on startup so a restarted process is warm without
+	// reading or parsing anything up front, new entries are kept in memory
+	// and merged into a fresh snapshot by `save`. This happens every
+	// `flush_bytes` of new entries or `flush_interval`, whichever is first,
+	// and when the process exits early on an error, so the memory used
+	// stays bounded and a failed run keeps what it already rendered.
+	//
+	// layout: header, index of `Entry` sorted by key, blob of outputs.
+	class Cache {
+		private:
+			struct Header {
+				char magic[8];
+				uint64_t version;
+				uint64_t count;
+			};
+
+			struct Entry {
+				uint64_t hash;
+				uint64_t length;
+				uint64_t offset;
+				uint64_t size;
+			};
+
+			// A mapped snapshot file, replaced as a whole on every save.
+			// Readers keep the one they looked up alive while they use it.
+			struct Snapshot {
+				const char* map = nullptr;
+				size_t size = 0;
+
+				const Entry* entries = nullptr;
+				uint64_t count = 0;
+
+				Snapshot() = default;
+				Snapshot(const Snapshot&) = delete;
+				Snapshot& operator=(const Snapshot&) = delete;
+
+				~Snapshot() {
+					if (map != nullptr)
+						::munmap(const_cast<char*>(map), size);
+				}
+			};
+
+			static constexpr const char magic[8] = { 's', 'e', 'e', 'd', 's', 'n', 'a', 'p' };
+			static constexpr uint64_t version = 1;
+
+			static constexpr size_t flush_bytes = 64ull << 20;
+			static constexpr auto flush_interval = std::chrono::seconds{30};
+
+			static inline std::atomic<Cache*> live{nullptr};  // saved by `std::exit`.
+
+			std::string path;
+			std::shared_ptr<const Snapshot> snapshot;  // only through std::atomic_load/store.
+
+			std::mutex mtx;
+			std::map<std::pair<uint64_t, uint64_t>, std::shared_ptr<const std::string>> fresh;
+			size_t fresh_bytes = 0;
+			std::chrono::steady_clock::time_point saved = std::chrono::steady_clock::now();
+
+
+		private:
+			std::shared_ptr<const Snapshot> load() const {
+				auto snap = std::make_shared<Snapshot>();
+				int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+				if (fd == -1)
+					return snap;
+
+				struct stat st;
+				if (::fstat(fd, &st) == 0 and static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+					size_t size = static_cast<size_t>(st.st_size);
+					void* ptr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+					if (ptr != MAP_FAILED) {
+						snap->map = static_cast<const char*>(ptr);
+						snap->size = size;
+					}
+				}
+
+				::close(fd);
+
+				if (snap->map == nullptr)
+					return snap;
+
+				const auto* header = reinterpret_cast<const Header*>(snap->map);
+				const auto* index = reinterpret_cast<const Entry*>(snap->map + sizeof(Header));
+
+				bool valid =
+					std::memcmp(header->magic, magic, sizeof(magic)) == 0 and
+					header->version == version and
+					header->count <= (snap->size - sizeof(Header)) / sizeof(Entry);
+
+				for (uint64_t i = 0; valid and i != header->count; ++i) {
+					valid = index[i].offset <= snap->size and index[i].size <= snap->size - index[i].offset;
+				}
+
+				if (not valid) {
+					std::cerr << "warning: ignoring invalid cache `" << path << "`.\n";
+					return snap;
+				}
+
+				snap->entries = index;
+				snap->count = header->count;
+
+				return snap;
+			}
+
+			static const Entry* find_mapped(const Snapshot& snap, const RenderKey& key) {
+				auto it = std::lower_bound(snap.entries, snap.entries + snap.count, key, [] (const Entry& e, const RenderKey& k) {
+					return std::tie(e.hash, e.length) < std::tie(k.hash, k.length);
+				});
+
+				if (it == snap.entries + snap.count or it->hash != key.hash or it->length != key.length)
+					return nullptr;
+
+				return it;
+			}
+
+			static void save_at_exit() {
+				if (Cache* cache = live.exchange(nullptr))
+					cache->save();
+			}
+
+			// Merge the mapped and fresh entries into a new snapshot,
+			// atomically replace the old one and map it in its place.
+			void save_locked() {
+				if (not enabled() or fresh.empty())
+					return;
+
+				auto snap = std::atomic_load(&snapshot);
+
+				std::vector<std::pair<Entry, const char*>> merged;
+				merged.reserve(snap->count + fresh.size());
+
+				for (uint64_t i = 0; i != snap->count; ++i) {
+					merged.emplace_back(snap->entries[i], snap->map + snap->entries[i].offset);
+				}
+
+				for (const auto& [key, value]: fresh) {
+					merged.emplace_back(Entry{ key.first, key.second, 0, value->size() }, value->data());
+				}
+
+				std::sort(merged.begin(), merged.end(), [] (const auto& a, const auto& b) {
+					return std::tie(a.first.hash, a.first.length) < std::tie(b.first.hash, b.first.length);
+				});
+
+				uint64_t offset = sizeof(Header) + merged.size() * sizeof(Entry);
+
+				std::vector<Entry> index;
+				index.reserve(merged.size());
+
+				for (auto& [e, data]: merged) {
+					e.offset = offset;
+					offset += e.size;
+					index.emplace_back(e);
+				}
+
+				Header header{};
+				std::memcpy(header.magic, magic, sizeof(magic));
+				header.version = version;
+				header.count = index.size();
+
+				const std::string tmp = path + ".tmp." + std::to_string(::getpid());
+				std::ofstream os(tmp, std::ios::binary | std::ios::trunc);
+
+				os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+				os.write(reinterpret_cast<const char*>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(Entry)));
+
+				for (const auto& [e, data]: merged) {
+					os.write(data, static_cast<std::streamsize>(e.size));
+				}
+
+				os.close();
+
+				if (not os or std::rename(tmp.c_str(), path.c_str()) != 0) {
+					std::remove(tmp.c_str());
+					live = nullptr;  // already failing, don't try again on exit.
+					error("could not write cache `", path, "`.");
+				}
+
+				std::atomic_store(&snapshot, load());
+
+				fresh.clear();
+				fresh_bytes = 0;
+				saved = std::chrono::steady_clock::now();
+			}
+
+
+		public:
+			Cache(const std::string& path_): path(path_) {
+				if (not enabled()) {
+					snapshot = std::make_shared<const Snapshot>();
+					return;
+				}
+
+				snapshot = load();
+
+				static const bool registered = std::atexit(save_at_exit) == 0;
+				static_cast<void>(registered);
+
+				live = this;
+			}
+
+			~Cache() {
+				Cache* self = this;
+				live.compare_exchange_strong(self, nullptr);
+			}
+
+			Cache(const Cache&) = delete;
+			Cache& operator=(const Cache&) = delete;
+
+
+		public:
+			bool enabled() const {
+				return not path.empty();
+			}
+
+			std::shared_ptr<const std::string> find(const RenderKey& key) {
+				auto snap = std::atomic_load(&snapshot);
+
+				if (const Entry* e = find_mapped(*snap, key))
+					return std::make_shared<const std::string>(snap->map + e->offset, e->size);
+
+				std::lock_guard<std::mutex> lock{mtx};
+
+				if (auto it = fresh.find({ key.hash, key.length }); it != fresh.end())
+					return it->second;
+
+				return nullptr;
+			}
+
+			// Like `find` but without copying, the view stays valid as long
+			// as `owner` is kept. `data()` is null when there is no entry.
+			std::string_view lookup(const RenderKey& key, std::shared_ptr<const void>& owner) {
+				auto snap = std::atomic_load(&snapshot);
+
+				if (const Entry* e = find_mapped(*snap, key)) {
+					owner = snap;
+					return { snap->map + e->offset, e->size };
+				}
+
+				std::lock_guard<std::mutex> lock{mtx};
+
+				if (auto it = fresh.find({ key.hash, key.length }); it != fresh.end()) {
+					owner = it->second;
+					return *it->second;
+				}
+
+				return {};
+			}
+
+			void insert(const RenderKey& key, std::shared_ptr<const std::string> value) {
+				if (not enabled() or find_mapped(*std::atomic_load(&snapshot), key) != nullptr)
+					return;
+
+				std::lock_guard<std::mutex> lock{mtx};
+
+				size_t size = value->size();
+
+				if (fresh.emplace(std::make_pair(key.hash, key.length), std::move(value)).second)
+					fresh_bytes += size;
+
+				if (fresh_bytes >= flush_bytes or std::chrono::steady_clock::now() - saved >= flush_interval)
+					save_locked();
+			}
+
+			void save() {
+				std::lock_guard<std::mutex> lock{mtx};
+				save_locked();
+			}
+	};
+}
+
+
+namespace seed {
+	// gzip in the style of pigz: the input is cut into blocks that are
+	// deflated independently on `jobs` threads and concatenated. Every block
+	// but the last ends on a byte boundary with a sync flush so the raw
+	// deflate streams can simply be appended to each other. The checksum of
+	// each block is combined in order for the trailer.
+	inline std::string gzip(std::string_view in, unsigned jobs, int level = Z_DEFAULT_COMPRESSION) {
+		static constexpr size_t block_size = 128 * 1024;
+
+		struct Block {
+			std::string data;
+			uLong crc = 0;
+			size_t length = 0;
+		};
+
+		size_t count = std::max<size_t>(1, (in.size() + block_size - 1) / block_size);
+		std::vector<Block> blocks(count);
+		std::atomic<size_t> next{0};
+
+		seed::parallel(std::min<size_t>(jobs, count), [&] {
+			z_stream zs{};
+
+			if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+				error("deflateInit2 failed.");
+
+			for (size_t i; (i = next++) < count;) {
+				auto& block = blocks[i];
+				std::string_view chunk = in.substr(std::min(in.size(), i * block_size), block_size);
+
+				bool last = i == count - 1;
+
+				block.length = chunk.size();
+				block.crc = crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(chunk.data()), static_cast<uInt>(chunk.size()));
+				block.data.resize(deflateBound(&zs, chunk.size()) + 16);
+
+				deflateReset(&zs);
+
+				zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(chunk.data()));
+				zs.avail_in = static_cast<uInt>(chunk.size());
+				zs.next_out = reinterpret_cast<Bytef*>(block.data.data());
+				zs.avail_out = static_cast<uInt>(block.data.size());
+
+				int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+
+				if (ret != (last ? Z_STREAM_END : Z_OK) or zs.avail_in != 0)
+					error("deflate failed.");
+
+				block.data.resize(block.data.size() - zs.avail_out);
+			}
+
+			deflateEnd(&zs);
+		});
+
+		uLong crc = crc32(0, Z_NULL, 0);
+		size_t total = 10 + 8;
+
+		for (const auto& block: blocks) {
+			crc = crc32_combine(crc, block.crc, static_cast<z_off_t>(block.length));
+			total += block.data.size();
+		}
+
+		std::string out;
+		out.reserve(total);
+
+		// magic, deflate, no flags, no mtime, no extra flags, unix.
+		out.append("\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\x03", 10);
+
+		for (const auto& block: blocks) {
+			out += block.data;
+		}
+
+		auto le32 = [&] (uint32_t x) {
+			for (int i = 0; i != 4; ++i) {
+				out += static_cast<char>((x >> (i * 8)) & 0xff);
+			}
+		};
+
+		le32(static_cast<uint32_t>(crc));
+		le32(static_cast<uint32_t>(in.size()));
 
-		return str;
+		return out;
 	}
 }
 
 
 namespace seed {
-	struct View {
-		const char *begin = nullptr;
-		int length = 0;
+	// Where the output of `fname` goes under `dir`: its mirrored path with
+	// `.dot` or `.dot.gz` appended.
+	inline std::string output_path(const std::string& dir, const std::string& fname, bool gzip) {
+		return mirror_path(dir, fname) + (gzip ? ".dot.gz" : ".dot");
+	}
 
-		constexpr View() {}
 
-		constexpr View(const char* const begin_, const char* const end_):
-			begin(begin_), length(end_ - begin_) {}
+	// Written to a temporary file next to `path` and renamed into place by
+	// `commit` so a partial output is never visible under its final name.
+	class AtomicFile {
+		private:
+			std::string path, tmp;
+			int fd = -1;
 
-		constexpr View(const char* const begin_, int length_):
-			begin(begin_), length(length_) {}
 
-		std::string str() const {
-			return std::string{begin, static_cast<std::string::size_type>(length)};
-		}
-	};
+		private:
+			[[noreturn]] void fail(const std::string& what) {
+				if (fd != -1)
+					::close(fd);
 
-	inline std::ostream& operator<<(std::ostream& os, const View& v) {
-		const auto& [vbegin, vlength] = v;
-		os.write(vbegin, vlength);
-		return os;
-	}
-}
+				::unlink(tmp.c_str());
+				error("could not write `", what, "`: ", std::strerror(errno));
+			}
 
 
-namespace seed {
-	struct Token {
-		View view{};
-		uint8_t type = 0;
+		public:
+			AtomicFile(const std::string& path_): path(path_) {
+				static std::atomic<uint64_t> counter{0};
 
-		constexpr Token() {}
+				std::filesystem::path target{path};
+				std::error_code ec;
 
-		constexpr Token(View view_, uint8_t type_):
-			view(view_), type(type_) {}
+				if (target.has_parent_path())
+					std::filesystem::create_directories(target.parent_path(), ec);
 
-		std::string str() const {
-			return view.str();
-		}
+				tmp = (target.parent_path() / ("." + target.filename().string())).string() +
+					".tmp." + std::to_string(::getpid()) + "." + std::to_string(counter++);
+
+				fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+				if (fd == -1)
+					error("could not create `", tmp, "`: ", std::strerror(errno));
+			}
+
+			~AtomicFile() {
+				if (fd != -1) {
+					::close(fd);
+					::unlink(tmp.c_str());
+				}
+			}
+
+			AtomicFile(const AtomicFile&) = delete;
+			AtomicFile& operator=(const AtomicFile&) = delete;
+
+
+		public:
+			void write(std::string_view str) {
+				for (size_t done = 0; done != str.size();) {
+					ssize_t n = ::write(fd, str.data() + done, str.size() - done);
+
+					if (n < 0 and errno == EINTR)
+						continue;
+
+					if (n < 0)
+						fail(tmp);
+
+					done += static_cast<size_t>(n);
+				}
+			}
+
+			void commit() {
+				int closed = ::close(fd);
+				fd = -1;
+
+				if (closed != 0 or std::rename(tmp.c_str(), path.c_str()) != 0) {
+					::unlink(tmp.c_str());
+					error("could not write `", path, "`: ", std::strerror(errno));
+				}
+			}
 	};
 
-	constexpr bool operator==(const Token& t, const uint8_t type) {
-		return t.type == type;
-	}
 
-	constexpr bool operator!=(const Token& t, const uint8_t type) {
-		return not(t == type);
-	}
+	inline void write_atomic(const std::string& path, std::string_view str) {
+		AtomicFile file{path};
 
-	inline std::ostream& operator<<(std::ostream& os, const Token& t) {
-		const auto& [view, type] = t;
-		return (os << view);
+		file.write(str);
+		file.commit();
 	}
-}
 
 
-namespace seed {
-	template <typename... Ts>
-	constexpr bool in_group(char c, Ts&&... args) {
-		return ((c == args) or ...);
-	}
+	// Append-only record of finished inputs, one `<hash> <path>` line per
+	// output written, so an interrupted batch can be restarted and skip
+	// what it already did. Entries only count while the input and the
+	// options hash the same. Each record is a single `write` to a file
+	// opened for appending so concurrent workers never interleave lines.
+	class Journal {
+		private:
+			int fd = -1;
+			std::unordered_map<std::string, uint64_t> finished;
 
-	constexpr bool is_whitespace(char c) {
-		return in_group(c, ' ', '\n', '\t', '\v', '\f');
-	}
-}
 
+		public:
+			Journal(const std::string& path) {
+				if (path.empty())
+					return;
 
-namespace seed {
-	using node_t = int64_t;
+				std::ifstream is(path);
+				std::string line;
+
+				while (std::getline(is, line)) {
+					size_t space = line.find(' ');
+
+					// A torn last line from a crash is ignored.
+					if (space != 16 or line.size() == space + 1)
+						continue;
+
+					finished[line.substr(space + 1)] = std::strtoull(line.substr(0, space).c_str(), nullptr, 16);
+				}
+
+				fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+				if (fd == -1)
+					error("could not open journal `", path, "`: ", std::strerror(errno));
+			}
+
+			~Journal() {
+				if (fd != -1)
+					::close(fd);
+			}
+
+			Journal(const Journal&) = delete;
+			Journal& operator=(const Journal&) = delete;
 
-	template <typename... Ts>
-	class HomogenousVector: public std::vector<std::variant<Ts...>> {
-		using std::vector<std::variant<Ts...>>::vector;
 
 		public:
-			template <typename T, typename... Xs>
-			node_t add(Xs&&... args) {
-				this->emplace_back(std::in_place_type<T>, std::forward<Xs>(args)...);
-				return { static_cast<int64_t>(this->size() - 1) };
+			// Only read during the run so it needs no locking.
+			bool done(const std::string& fname, uint64_t hash) const {
+				auto it = finished.find(fname);
+				return it != finished.end() and it->second == hash;
+			}
+
+			void append(const std::string& fname, uint64_t hash) {
+				if (fd == -1)
+					return;
+
+				char buf[17];
+				std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(hash));
+
+				const std::string line = std::string{buf} + " " + fname + "\n";
+
+				if (::write(fd, line.data(), line.size()) != static_cast<ssize_t>(line.size()))
+					error("could not append to journal: ", std::strerror(errno));
 			}
 	};
 }
 
 
 namespace seed {
-	struct Position {
-		int line = 1, column = 1;
-	};
+	// Collects root profiles from every file, reports the most expensive
+	// roots and writes all of them as CSV.
+	class Profiler {
+		private:
+			struct Entry {
+				std::string file;
+				size_t root;
+				seed::RootProfile p;
+			};
 
+			std::mutex mtx;
+			std::vector<Entry> entries;
 
-	std::ostream& operator<<(std::ostream& os, const Position& pos) {
-		return (os << pos.line << ':' << pos.column);
-	}
 
+		private:
+			static std::string csv_field(const std::string& str) {
+				if (str.find_first_of(",\"\n") == std::string::npos)
+					return str;
+
+				std::string out = "\"";
 
-	Position position(const char* ptr, const char* const end) {
-		Position coord;
-		auto& [line, column] = coord;
+				for (char chr: str) {
+					out += chr == '"' ? std::string{"\"\""} : std::string{chr};
+				}
 
-		while (ptr++ != end) {
-			if (*ptr == '\n') {
-				column = 1;
-				line++;
+				return out + "\"";
 			}
 
-			else {
-				column++;
+			static double cost(const Entry& e) {
+				return e.p.parse_us + e.p.render_us;
 			}
-		}
 
-		return coord;
-	}
-}
 
+		public:
+			// Fill in positions, sizes and depths of the final trees, after
+			// any rewriting, they are only needed here.
+			void add(const std::string& fname, const std::string& src, const seed::AST& tree, const std::vector<seed::node_t>& roots, seed::Profile& profile) {
+				seed::LineIndex lines{src.data(), src.data() + src.size()};
+
+				for (size_t i = 0; i != profile.size(); ++i) {
+					auto& p = profile[i];
+					p.pos = lines.position(p.at);
+
+					std::vector<std::pair<seed::node_t, uint64_t>> stack{ { roots[i], 1 } };
+
+					while (not stack.empty()) {
+						auto [n, depth] = stack.back();
+						stack.pop_back();
+
+						p.depth = std::max(p.depth, depth);
+						p.nodes++;
+
+						if (const auto* c = children(tree, n)) {
+							for (seed::node_t child: *c) {
+								stack.emplace_back(child, depth + 1);
+							}
+						}
+					}
+				}
 
-namespace seed {
-	template <typename... Ts> struct overloaded: Ts... { using Ts::operator()...; };
-	template <typename... Ts> overloaded(Ts...) -> overloaded<Ts...>;
+				std::lock_guard<std::mutex> lock{mtx};
 
-	template <typename V, typename... Ts>
-	constexpr decltype(auto) visit(V&& variant, Ts&&... args) {
-		return std::visit(seed::overloaded{
-			std::forward<Ts>(args)...
-		}, variant);
-	}
-}
+				for (size_t i = 0; i != profile.size(); ++i) {
+					entries.push_back({ fname, i, profile[i] });
+				}
+			}
+
+			void report(const std::string& csv, size_t top, std::ostream& os) {
+				std::lock_guard<std::mutex> lock{mtx};
+
+				std::sort(entries.begin(), entries.end(), [] (const Entry& a, const Entry& b) {
+					return cost(a) > cost(b);
+				});
+
+				std::string str = "file,root,line,column,bytes,nodes,depth,parse_us,render_us,total_us\n";
+
+				for (const auto& [file, root, p]: entries) {
+					str += strcat(
+						csv_field(file), ",", root, ",", p.pos.line, ",", p.pos.column, ",",
+						p.bytes, ",", p.nodes, ",", p.depth, ",",
+						p.parse_us, ",", p.render_us, ",", p.parse_us + p.render_us, "\n"
+					);
+				}
+
+				write_atomic(csv, str);
+
+				os << "root profile, " << entries.size() << " roots, written to `" << csv << "`:\n";
+				os << "rank  total(us)   parse(us)   render(us)  bytes       nodes     depth  location\n";
+
+				for (size_t i = 0; i != std::min(top, entries.size()); ++i) {
+					const auto& [file, root, p] = entries[i];
 
+					os << std::left << std::fixed << std::setprecision(1)
+						<< std::setw(6) << i + 1
+						<< std::setw(12) << p.parse_us + p.render_us
+						<< std::setw(12) << p.parse_us
+						<< std::setw(12) << p.render_us
+						<< std::setw(12) << p.bytes
+						<< std::setw(10) << p.nodes
+						<< std::setw(7) << p.depth
+						<< file << ":" << p.pos << '\n';
+				}
+			}
+	};
+}
 
 
 namespace seed {
-	template <typename... Ts>
-	[[noreturn]] inline void error(Ts&&... args) {
-		([] () -> std::ostream& {
-			return (std::cerr << "error: ");
-		} () << ... << std::forward<Ts>(args)) << '\n';
+	// Rendered roots are cached on their own, keyed by the bytes of the
+	// form, so unchanged roots are reused whatever file or position they
+	// appear in. A fragment is the body of a cluster rendered from id 0:
+	//
+	//   u32 ids used, u32 relocation count, u32 relocations[], text.
+	inline std::string render_fragment(const seed::AST& tree, seed::node_t root, int indent_size) {
+		std::string body;
+		seed::Relocations relocs;
+		int node_counter = 0;
 
-		std::exit(1);
-	}
+		render_nodes(tree[root], tree, body, indent_size, node_counter, node_counter, &relocs);
+		node_counter++;
+
+		auto ids = static_cast<uint32_t>(node_counter);
+		auto count = static_cast<uint32_t>(relocs.size());
+
+		std::string blob(sizeof(ids) + sizeof(count) + count * sizeof(uint32_t), '\0');
 
+		std::memcpy(blob.data(), &ids, sizeof(ids));
+		std::memcpy(blob.data() + sizeof(ids), &count, sizeof(count));
+		std::memcpy(blob.data() + sizeof(ids) + sizeof(count), relocs.data(), count * sizeof(uint32_t));
 
-	inline std::string tabs(int n) {
-		return std::string(n, '\t');
+		return blob + body;
 	}
 
 
-	template <typename... Ts>
-	inline std::string strcat(Ts&&... args) {
-		std::string buf{sizeof...(Ts), '\0'};
+	// Append a fragment with every id offset by `base`, returns the number
+	// of ids it uses or -1 without appending anything if the fragment is
+	// damaged, it may come from a mapped snapshot.
+	inline int relocate(std::string_view frag, int base, std::string& str) {
+		static constexpr size_t max_digits = 9;  // ids fit an int.
 
-		std::stringstream ss{buf};
-		((ss << std::forward<Ts>(args)), ...);
+		uint32_t ids = 0, count = 0;
 
-		return ss.str();
-	}
-}
+		if (frag.size() < sizeof(ids) + sizeof(count))
+			return -1;
 
+		std::memcpy(&ids, frag.data(), sizeof(ids));
+		std::memcpy(&count, frag.data() + sizeof(ids), sizeof(count));
 
-namespace seed {
-	#define TOKENS \
-		X(TOKEN_NONE) \
-		X(TOKEN_EOF) \
-		X(TOKEN_LPAREN) \
-		X(TOKEN_RPAREN) \
-		X(TOKEN_STRING) \
-		X(TOKEN_IDENTIFIER)
+		if (ids > static_cast<uint32_t>(std::numeric_limits<int>::max()) or count > (frag.size() - sizeof(ids) - sizeof(count)) / sizeof(uint32_t))
+			return -1;
 
-	#define X(x) #x,
-		const char* to_str[] = { TOKENS };
-	#undef X
+		const char* relocs = frag.data() + sizeof(ids) + sizeof(count);
+		std::string_view body = frag.substr(sizeof(ids) + sizeof(count) + count * sizeof(uint32_t));
 
-	#define X(x) x,
-		enum { TOKENS };
-	#undef X
+		// Relocations are in order, inside the body and on short numbers.
+		for (size_t i = 0, prev = 0; i != count; ++i) {
+			uint32_t at = 0;
+			std::memcpy(&at, relocs + i * sizeof(uint32_t), sizeof(at));
 
-	#undef TOKENS
+			if (at < prev or at > body.size())
+				return -1;
 
+			size_t end = at;
 
-	inline seed::Token next_token(const char* const start, const char*& ptr) {
-		seed::Token tok{{ptr, 1}, TOKEN_NONE};
+			while (end != body.size() and body[end] >= '0' and body[end] <= '9') {
+				end++;
+			}
 
-		auto& [view, type] = tok;
-		auto& [vptr, vlen] = view;
+			if (end - at > max_digits)
+				return -1;
 
-		if (*ptr == '\0') {
-			type = TOKEN_EOF;
+			prev = end;
 		}
 
-		else if (*ptr == '(') { type = TOKEN_LPAREN; ++ptr; }
-		else if (*ptr == ')') { type = TOKEN_RPAREN; ++ptr; }
+		size_t done = 0;
+		char buf[16];
 
-		else if ((*ptr == '"' or *ptr == '\'') and *(ptr - 1) != '\\') {
-			type = TOKEN_STRING;
-			char delim = *ptr;
+		for (uint32_t i = 0; i != count; ++i) {
+			uint32_t at = 0;
+			std::memcpy(&at, relocs + i * sizeof(uint32_t), sizeof(at));
 
-			do {
-				++ptr;
-			} while (*ptr != delim and *ptr);
+			size_t end = at;
+			int id = 0;
 
-			++ptr;  // skip end quote.
+			while (end != body.size() and body[end] >= '0' and body[end] <= '9') {
+				id = id * 10 + (body[end++] - '0');
+			}
+
+			str.append(body.data() + done, at - done);
 
-			// remove quotes.
-			vptr++;
-			vlen = ptr - vptr - 1;
+			auto [ptr, ec] = std::to_chars(buf, buf + sizeof(buf), id + base);
+			str.append(buf, ptr);
+
+			done = end;
 		}
 
-		else if (not seed::is_whitespace(*ptr)) {
-			type = TOKEN_IDENTIFIER;
+		str.append(body.data() + done, body.size() - done);
+
+		return static_cast<int>(ids);
+	}
+
+
+	inline std::string render_cached(
+		const std::vector<seed::node_t>& roots,
+		const seed::AST& tree,
+		seed::Cache& cache,
+		uint64_t options,
+		const std::string& title,
+		seed::Progress& counts
+	) {
+		static constexpr uint64_t fragment_tag = 0x66726167;  // keeps fragments apart from whole files.
+
+		int node_counter = 0;
+		std::string str = title + " {\n";
+
+		int graph_id = 0;
+		for (const seed::node_t& n: roots) {
+			size_t before = str.size();
+			str += tabs(1) + "subgraph cluster" + std::to_string(graph_id) + " {\n";
+
+			seed::View v = seed::span(tree, n);
 
-			if (*ptr == '\\') {
-				++vptr;
+			if (v.begin == nullptr) {
+				render_nodes(tree[n], tree, str, 2, node_counter, node_counter);
+				node_counter++;
 			}
 
-			do {
-				++ptr;
-			} while (not seed::is_whitespace(*ptr) and not in_group(*ptr, '(', ')'));
+			else {
+				RenderKey key{ mix(hash_bytes(v.begin, static_cast<size_t>(v.length), options), fragment_tag), static_cast<size_t>(v.length) };
+				std::shared_ptr<const void> owner;
+				std::string_view frag = cache.lookup(key, owner);
+
+				int ids = frag.data() == nullptr ? -1 : relocate(frag, node_counter, str);
+
+				// Missing or damaged, a damaged mapped entry stays in place
+				// until the snapshot is rewritten.
+				if (ids == -1) {
+					auto blob = std::make_shared<const std::string>(render_fragment(tree, n, 2));
+					ids = relocate(*blob, node_counter, str);
+					cache.insert(key, std::move(blob));
+				}
 
-			vlen = ptr - vptr;
-		}
+				node_counter += ids;
+			}
 
-		else if (seed::is_whitespace(*ptr)) {
-			do {
-				++ptr;
-			} while (seed::is_whitespace(*ptr));
+			str += tabs(1) + "}\n";
+			graph_id++;
 
-			return next_token(start, ptr);
+			counts.rendered.fetch_add(str.size() - before, std::memory_order_relaxed);
+			counts.done.fetch_add(static_cast<uint64_t>(v.length), std::memory_order_relaxed);
 		}
 
-		else {
-			error(seed::position(start, ptr), ": unexpected character `", *ptr, "`(", (int)*ptr, ").");
+		return str + "}\n";
+	}
+
+
+	inline std::string render_source(
+		const std::string& fname,
+		const std::string& src,
+		const Options& opts,
+		Cache& cache,
+		Profiler* profiler,
+		seed::Progress& counts,
+		bool& clean
+	) {
+		seed::AST tree;
+
+		if (opts.fused)
+			return seed::render_fused(fname, src, opts.title, counts);
+
+		// Profiled roots are always rendered, never taken from the cache.
+		// Every token but `)` is at most one node, reserving for them up
+		// front keeps the growth of the tree out of the timings.
+		if (profiler != nullptr) {
+			size_t nodes = 0;
+
+			for (seed::Lexer lex{src.c_str()}; lex.peek() != seed::TOKEN_EOF;) {
+				nodes += lex.advance() != seed::TOKEN_RPAREN;
+			}
+
+			seed::Profile profile;
+			tree.reserve(nodes);
+			auto roots = seed::parse_file(fname, src, tree, opts.partial, &profile, &counts, &clean);
+
+			if (opts.rules)
+				opts.rules->rewrite(tree, roots);
+
+			seed::relayout(roots, tree, opts.layout);
+
+			auto str = seed::render(roots, tree, opts.title, 0, &profile, &counts);
+			profiler->add(fname, src, tree, roots, profile);
+
+			return str;
 		}
 
-		return tok;
+		auto roots = seed::parse_file(fname, src, tree, opts.partial, nullptr, &counts, &clean);
+
+		if (opts.rules)
+			opts.rules->rewrite(tree, roots);
+
+		seed::relayout(roots, tree, opts.layout);
+
+		if (cache.enabled())
+			return seed::render_cached(roots, tree, cache, options_key(opts), opts.title, counts);
+
+		return seed::render(roots, tree, opts.title, 0, nullptr, &counts);
 	}
 
 
-	class Lexer {
-		private:
-			const char* const start = nullptr;
-			const char* str = nullptr;
-			Token lookahead{};
+	inline std::shared_ptr<const Rendered> render_file(
+		const std::string& fname,
+		const std::string& src,
+		const RenderKey& key,
+		const Options& opts,
+		RenderFlight& flight,
+		Cache& cache,
+		Profiler* profiler,
+		seed::Progress& counts
+	) {
+		auto rendered = flight.run(key, [&] {
+			Rendered r;
 
+			if (auto hit = cache.find(key)) {
+				counts.lexed.fetch_add(src.size(), std::memory_order_relaxed);
+				counts.rendered.fetch_add(hit->size(), std::memory_order_relaxed);
 
-		public:
-			Lexer(const char* const str_): start(str_), str{str_} {
-				advance();
+				r.out = std::move(hit);
 			}
 
+			else {
+				r.out = std::make_shared<const std::string>(render_source(fname, src, opts, cache, profiler, counts, r.clean));
+			}
 
-		public:
-			const Token& peek() const {
-				return lookahead;
+			return std::make_shared<const Rendered>(std::move(r));
+		});
+
+		// Otherwise the roots are already cached as fragments.
+		if (opts.fused)
+			cache.insert(key, rendered->out);
+
+		return rendered;
+	}
+
+
+	// Render every file on a pool of workers, identical inputs that are in
+	// flight at the same time are only rendered once. With an output
+	// directory every output is written as soon as it is done, inputs
+	// already in the journal are skipped. Otherwise outputs are printed in
+	// order as soon as every file before them is printed.
+	inline void render_files(const Options& opts, std::ostream& os) {
+		const auto& files = opts.files;
+
+		// Outputs done but still waiting on an earlier file.
+		std::vector<std::shared_ptr<const std::string>> outputs(files.size());
+		std::vector<bool> ready(files.size());
+		size_t printed = 0;
+		bool printing = false;
+		std::mutex mtx;
+
+		std::atomic<size_t> next{0};
+		RenderFlight flight;
+		Cache cache{opts.cache};
+		Journal journal{opts.journal};
+
+		std::unique_ptr<Profiler> profiler;
+
+		if (not opts.profile_roots.empty())
+			profiler = std::make_unique<Profiler>();
+
+		// `--fused` outputs that are neither cached nor compressed are never
+		// held whole but streamed in chunks, one file at a time to stdout to
+		// keep them in order.
+		static constexpr size_t chunk = 1 << 20;
+
+		const bool stream = opts.fused and not cache.enabled() and not opts.gzip;
+		const size_t workers = stream and opts.output_dir.empty() ? 1 : std::min<size_t>(opts.jobs, files.size());
+
+		// Whoever finds the next output in order ready prints it and any
+		// that follow, outside the lock so other workers aren't held up.
+		auto print = [&] (size_t i, std::shared_ptr<const std::string> out) {
+			std::unique_lock<std::mutex> lock{mtx};
+
+			outputs[i] = std::move(out);
+			ready[i] = true;
+
+			if (printing)
+				return;
+
+			printing = true;
+
+			while (printed != files.size() and ready[printed]) {
+				auto str = std::move(outputs[printed]);
+				lock.unlock();
+
+				if (str != nullptr and opts.gzip)
+					os << gzip(*str, files.size() == 1 ? opts.jobs : 1);
+				else if (str != nullptr)
+					os << *str;
+
+				str.reset();
+				lock.lock();
+				printed++;
 			}
 
-			Token advance() {
-				Token tok = peek();
-				lookahead = next_token(start, str);
-				return tok;
+			printing = false;
+		};
+
+		auto render_one = [&] (size_t i, const std::string& src, const RenderKey& key, seed::Progress& counts) {
+			const auto& fname = files[i];
+
+			// Whatever was printed before a syntax error stays printed.
+			if (opts.output_dir.empty() and stream) {
+				auto err = render_fused(src, opts.title, chunk, counts, [&] (std::string& str) {
+					os << str;
+				});
+
+				if (err.at != nullptr)
+					fused_error(fname, src, err);
+
+				return;
 			}
 
-			Position position() const {
-				return seed::position(start, str);
+			if (opts.output_dir.empty()) {
+				print(i, render_file(fname, src, key, opts, flight, cache, profiler.get(), counts)->out);
+				return;
 			}
-	};
-}
 
+			const auto path = output_path(opts.output_dir, fname, opts.gzip);
+			std::error_code ec;
 
-namespace seed {
-	struct Identifer {
-		seed::Token tok;
+			if (journal.done(fname, key.hash) and std::filesystem::exists(path, ec)) {
+				counts.lexed.fetch_add(src.size(), std::memory_order_relaxed);
+				return;
+			}
 
-		Identifer(const seed::Token& tok_): tok(tok_) {}
-		Identifer(): tok() {}
-	};
+			if (stream) {
+				seed::Diagnostic err;
 
-	struct String {
-		seed::Token tok;
+				// The temporary file is removed before exiting on an error.
+				{
+					AtomicFile file{path};
 
-		String(const seed::Token& tok_): tok(tok_) {}
-		String(): tok() {}
-	};
+					err = render_fused(src, opts.title, chunk, counts, [&] (std::string& str) {
+						file.write(str);
+					});
 
-	struct List {
-		seed::Token op;
-		std::vector<seed::node_t> children;
+					if (err.at == nullptr)
+						file.commit();
+				}
 
-		List(const seed::Token& op_, const std::vector<seed::node_t>& children_): op(op_), children(children_) {}
-		List(): op(), children() {}
-	};
+				if (err.at != nullptr)
+					fused_error(fname, src, err);
 
-	struct Empty {
-		Empty() {}
-	};
+				journal.append(fname, key.hash);
 
-	using AST = seed::HomogenousVector<List, Identifer, String, Empty>;
-}
+				return;
+			}
 
+			auto rendered = render_file(fname, src, key, opts, flight, cache, profiler.get(), counts);
 
-namespace seed {
-	inline seed::node_t expr(seed::Lexer& lex, seed::AST& tree) {
-		if (lex.advance() != TOKEN_LPAREN)
-			error(lex.position(), ": expected `(`.");
+			if (opts.gzip)
+				write_atomic(path, gzip(*rendered->out, files.size() == 1 ? opts.jobs : 1));
+			else
+				write_atomic(path, *rendered->out);
 
-		seed::Token op = lex.advance();
+			// With `--partial` a broken input is rendered again by a rerun
+			// so its errors are reported again.
+			if (rendered->clean)
+				journal.append(fname, key.hash);
+		};
 
-		if (op == TOKEN_RPAREN) {
-			return tree.add<Empty>();
-		}
+		seed::parallel(workers, [&] {
+			seed::Progress counts;
+			progress.attach(counts);
 
-		else if (op != TOKEN_IDENTIFIER and op != TOKEN_STRING)
-			error(lex.position(), ": expected identifer or string.");
+			for (size_t i; (i = next++) < files.size();) {
+				auto src = seed::read_file(files[i]);
+				RenderKey key{ hash_bytes(src, options_key(opts)), src.size() };
 
-		std::vector<seed::node_t> children;
+				progress.files.fetch_add(1, std::memory_order_relaxed);
 
-		while (lex.peek() != TOKEN_RPAREN and lex.peek() != TOKEN_EOF) {
-			if (lex.peek() == TOKEN_LPAREN) {
-				children.emplace_back(expr(lex, tree));
-			}
+				uint64_t before = counts.done;
+				render_one(i, src, key, counts);
 
-			else if (lex.peek() == TOKEN_IDENTIFIER) {
-				children.emplace_back(tree.add<Identifer>(lex.advance()));
+				// What the rendered roots didn't cover: whitespace between
+				// them, or all of it when the output came from the cache,
+				// another worker or the journal. `read_file` adds a nul.
+				uint64_t size = src.size() - 1;
+				counts.done.fetch_add(size - std::min(size, counts.done - before), std::memory_order_relaxed);
 			}
 
-			else if (lex.peek() == TOKEN_STRING) {
-				children.emplace_back(tree.add<String>(lex.advance()));
-			}
-		}
+			progress.detach(counts);
+		});
 
-		if (lex.advance() != TOKEN_RPAREN)
-			error(lex.position(), ": expected `)`.");
+		cache.save();
 
-		return tree.add<List>(op, children);
+		if (profiler != nullptr)
+			profiler->report(opts.profile_roots, opts.top, std::cerr);
 	}
 }
 
 
 namespace seed {
-	template <typename T>
-	void render_nodes(
-		const T& variant,
-		const seed::AST& tree,
-		std::string& str,
-		const int indent_size, int parent_id, int& node_counter
-	) {
-		seed::visit(variant,
-			[&] (const List& l) {
-				int self_id = node_counter++;
-				const auto& [op, children] = l;
+	inline volatile std::sig_atomic_t snapshot_requested = 0;
 
-				str += tabs(indent_size) + strcat("n", self_id, " [label=\"", op, "\"];\n");
 
-				if (self_id != parent_id) {
-					str += tabs(indent_size) + strcat("n", parent_id, " -> n", self_id, ";\n");
-				}
+	// Samples `progress` on its own thread and prints throughput and an
+	// estimate of the time left to stderr and/or rewrites a status file
+	// every `interval`. SIGUSR1 prints a snapshot to stderr at any time.
+	class ProgressReporter {
+		private:
+			using clock = std::chrono::steady_clock;
 
-				for (const auto& child: children) {
-					render_nodes(tree[child], tree, str, indent_size, self_id, node_counter);
-					node_counter++;
+			static constexpr auto poll = std::chrono::milliseconds(100);
+
+			bool to_stderr = false;
+			std::string status;
+			bool renders = false;  // otherwise only parsing is measured.
+			clock::duration interval;
+			clock::time_point start = clock::now();
+
+			std::mutex mtx;
+			std::condition_variable cv;
+			bool stopping = false;
+			std::thread worker;
+
+
+		private:
+			static std::string bytes(double n) {
+				const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+				size_t unit = 0;
+
+				while (n >= 1024 and unit != 4) {
+					n /= 1024;
+					unit++;
 				}
-			},
 
-			[&] (const Identifer& x) {
-				int self_id = node_counter++;
-				str += tabs(indent_size) + strcat("n", self_id, " [label=\"", x.tok, "\"];\n");
+				char buf[32];
+				std::snprintf(buf, sizeof(buf), "%.1f %s", n, units[unit]);
+
+				return buf;
+			}
+
+			std::string line() const {
+				double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+
+				uint64_t total = progress.total.load(std::memory_order_relaxed);
+				uint64_t lexed = std::min(total, progress.sum(&seed::Progress::lexed));
+
+				// Rendering takes most of the time so a run that renders is
+				// only as far along as its rendered roots, parsing alone
+				// would reach 100% long before the end.
+				uint64_t done = renders ? std::min(total, progress.sum(&seed::Progress::done)) : lexed;
 
-				if (self_id != parent_id) {
-					str += tabs(indent_size) + strcat("n", parent_id, " -> n", self_id, ";\n");
+				double rate = elapsed > 0 ? static_cast<double>(done) / elapsed : 0;
+
+				std::string eta = "?";
+
+				if (rate > 0) {
+					char buf[32];
+					std::snprintf(buf, sizeof(buf), "%.0fs", static_cast<double>(total - done) / rate);
+					eta = buf;
 				}
-			},
 
-			[&] (const String& x) {
-				int self_id = node_counter++;
+				char pct[16];
+				std::snprintf(pct, sizeof(pct), "%.1f%%", total ? 100.0 * static_cast<double>(done) / static_cast<double>(total) : 100.0);
+
+				return strcat(
+					"progress: ", bytes(static_cast<double>(done)), " / ", bytes(static_cast<double>(total)), " (", pct, ") done, ",
+					bytes(static_cast<double>(lexed)), " lexed, ",
+					progress.sum(&seed::Progress::nodes), " nodes, ",
+					bytes(static_cast<double>(progress.sum(&seed::Progress::rendered))), " rendered, ",
+					progress.files.load(std::memory_order_relaxed), " files, ",
+					bytes(rate), "/s, eta ", eta, "\n"
+				);
+			}
+
+			void report(bool periodic) {
+				auto str = line();
 
-				std::string newstr;
+				if (not periodic or to_stderr)
+					std::cerr << str;
 
-				for (auto chr: x.tok.str()) {
-					if (chr == '"')
-						newstr += "\\\"";
-					else
-						newstr += chr;
+				if (periodic and not status.empty())
+					write_atomic(status, str);
+			}
+
+			void run() {
+				auto next = start + interval;
+				std::unique_lock<std::mutex> lock{mtx};
+
+				while (not cv.wait_for(lock, poll, [&] { return stopping; })) {
+					if (snapshot_requested) {
+						snapshot_requested = 0;
+						report(false);
+					}
+
+					if ((to_stderr or not status.empty()) and clock::now() >= next) {
+						report(true);
+						next += interval;
+					}
 				}
+			}
+
 
-				str += tabs(indent_size) + strcat("n", self_id, " [label=\"", newstr, "\"];\n");
+		public:
+			ProgressReporter(bool to_stderr_, const std::string& status_, bool renders_, clock::duration interval_ = std::chrono::seconds(1)):
+				to_stderr(to_stderr_), status(status_), renders(renders_), interval(interval_)
+			{
+				struct sigaction sa{};
+				sa.sa_handler = [] (int) { snapshot_requested = 1; };
+				sa.sa_flags = SA_RESTART;
+				sigemptyset(&sa.sa_mask);
+				::sigaction(SIGUSR1, &sa, nullptr);
+
+				worker = std::thread([this] { run(); });
+			}
 
-				if (self_id != parent_id) {
-					str += tabs(indent_size) + strcat("n", parent_id, " -> n", self_id, ";\n");
+			~ProgressReporter() {
+				{
+					std::lock_guard<std::mutex> lock{mtx};
+					stopping = true;
 				}
-			},
 
-			[&] (const Empty&) {}
-		);
-	}
+				cv.notify_one();
+				worker.join();
 
+				if (not status.empty())
+					write_atomic(status, line());
+			}
 
-	template <typename T>
-	void render_cluster(
-		const T& variant,
-		const seed::AST& tree,
-		std::string& str,
-		int& node_counter,
-		const std::string& title = "subgraph",
-		const int indent_size = 0
-	) {
-		str += tabs(indent_size) + title + " {\n";
-			render_nodes(variant, tree, str, indent_size + 1, node_counter, node_counter);
-			node_counter++;
-		str += tabs(indent_size) + "}\n";
+			ProgressReporter(const ProgressReporter&) = delete;
+			ProgressReporter& operator=(const ProgressReporter&) = delete;
+	};
+}
+
+
+// `check.cpp` includes all of the above without the entry point.
+#ifndef SEED_NO_MAIN
+int main(int argc, const char* argv[]) {
+	seed::Options opts = seed::parse_args(argc, argv);
+
+	if (not opts.generate.empty()) {
+		auto shape = seed::read_shape(opts.generate);
+		seed::generate(shape, opts.generate_roots ? opts.generate_roots : shape.roots, opts.generate_seed, std::cout);
+
+		return 0;
 	}
 
+	if (opts.files.empty()) {
+		seed::usage();
+		return -1;
+	}
 
-	std::string render(
-		const std::vector<seed::node_t>& roots,
-		const seed::AST& tree,
-		const std::string& title = "digraph",
-		const int indent_size = 0
-	) {
-		int node_counter = 0;
-		std::string str;
+	std::error_code ec;
+	for (const auto& fname: opts.files) {
+		if (not std::filesystem::exists(fname, ec)) {
+			seed::error("file `", fname, "` does not exist.");
+		}
 
-		str += tabs(indent_size) + title + " {\n";
+		seed::progress.total += std::filesystem::file_size(fname, ec);
+	}
 
-		int graph_id = 0;
-		for (const seed::node_t& n: roots) {
-			render_cluster(tree[n], tree, str, node_counter, "subgraph cluster" + std::to_string(graph_id), indent_size + 1);
-			graph_id++;
+	bool renders = opts.extract.empty() and not opts.bench_layout and opts.lod.empty() and
+		not opts.similar and not opts.dupes and not opts.record_shape;
+
+	seed::ProgressReporter reporter{opts.show_progress, opts.status, renders};
+
+	if (not opts.extract.empty()) {
+		for (const auto& fname: opts.files) {
+			seed::extract_file(fname, opts.extract, opts.partial);
 		}
 
-		str += tabs(indent_size) + "}\n";
+		return seed::failed ? 1 : 0;
+	}
 
-		return str;
+	if (opts.bench_layout) {
+		for (const auto& fname: opts.files) {
+			std::cout << fname << ":\n";
+			seed::bench_layouts(seed::read_file(fname), std::cout);
+		}
+
+		return 0;
 	}
-}
 
+	if (not opts.lod.empty()) {
+		for (const auto& fname: opts.files) {
+			auto src = seed::read_file(fname);
 
-namespace seed {
-	std::vector<seed::node_t> parse(seed::Lexer& lex, seed::AST& tree) {
-		std::vector<seed::node_t> roots;
+			seed::AST tree;
+			auto roots = seed::parse_file(fname, src, tree, opts.partial);
 
-		while (lex.peek() != seed::TOKEN_EOF) {
-			roots.emplace_back(seed::expr(lex, tree));
+			if (opts.rules)
+				opts.rules->rewrite(tree, roots);
+
+			seed::write_levels(fname, tree, roots, opts.lod, opts.lod_factor, opts.title);
 		}
 
-		return roots;
+		return seed::failed ? 1 : 0;
 	}
-}
 
+	if (opts.similar) {
+		seed::similar(opts.files, opts.partial, opts.jobs, opts.top, opts.threshold, std::cout);
+		return seed::failed ? 1 : 0;
+	}
 
-int main(int argc, const char* argv[]) {
-	if (argc != 2) {
-		std::cerr << "usage: wpp <file>\n";
-		return -1;
+	if (opts.dupes) {
+		seed::dupes(opts.files, opts.partial, opts.jobs, opts.top, std::cout);
+		return seed::failed ? 1 : 0;
 	}
 
-	const std::string fname = argv[1];
+	if (opts.record_shape) {
+		seed::Shape shape;
+		std::unordered_map<uint64_t, uint64_t> seen;
 
-	std::error_code ec;
-	if (not std::filesystem::exists(fname, ec)) {
-		seed::error("file `", fname, "` does not exist.");
-	}
+		for (const auto& fname: opts.files) {
+			auto src = seed::read_file(fname);
 
-	auto expr = seed::read_file(fname);
+			seed::AST tree;
+			auto roots = seed::parse_file(fname, src, tree, opts.partial);
 
-	seed::AST tree;
-	seed::Lexer lex{expr.c_str()};
+			seed::record_shape(roots, tree, shape, seen);
+		}
 
-	auto roots = seed::parse(lex, tree);
-	std::cout << seed::render(roots, tree);
+		std::cout << seed::shape_str(shape);
+		return seed::failed ? 1 : 0;
+	}
 
-	return 0;
+	seed::render_files(opts, std::cout);
+	return seed::failed ? 1 : 0;
 }
+#endif
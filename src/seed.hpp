@@ -0,0 +1,822 @@
+// seed: lexer, parser, tree and renderer as a header only library.
+//
+//   #include <seed.hpp>
+//
+//   seed::Lexer lex{src.c_str()};
+//   seed::AST tree;
+//   std::cout << seed::render(seed::parse(lex, tree), tree);
+
+#pragma once
+
+#include <utility>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <variant>
+#include <string_view>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace seed {
+	struct View {
+		const char *begin = nullptr;
+		int length = 0;
+
+		constexpr View() {}
+
+		constexpr View(const char* const begin_, const char* const end_):
+			begin(begin_), length(end_ - begin_) {}
+
+		constexpr View(const char* const begin_, int length_):
+			begin(begin_), length(length_) {}
+
+		std::string str() const {
+			return std::string{begin, static_cast<std::string::size_type>(length)};
+		}
+	};
+
+	inline std::ostream& operator<<(std::ostream& os, const View& v) {
+		const auto& [vbegin, vlength] = v;
+		os.write(vbegin, vlength);
+		return os;
+	}
+}
+
+
+namespace seed {
+	struct Token {
+		View view{};
+		uint8_t type = 0;
+
+		constexpr Token() {}
+
+		constexpr Token(View view_, uint8_t type_):
+			view(view_), type(type_) {}
+
+		std::string str() const {
+			return view.str();
+		}
+	};
+
+	constexpr bool operator==(const Token& t, const uint8_t type) {
+		return t.type == type;
+	}
+
+	constexpr bool operator!=(const Token& t, const uint8_t type) {
+		return not(t == type);
+	}
+
+	inline std::ostream& operator<<(std::ostream& os, const Token& t) {
+		const auto& [view, type] = t;
+		return (os << view);
+	}
+}
+
+
+namespace seed {
+	template <typename... Ts>
+	constexpr bool in_group(char c, Ts&&... args) {
+		return ((c == args) or ...);
+	}
+
+	constexpr bool is_whitespace(char c) {
+		return in_group(c, ' ', '\n', '\t', '\v', '\f');
+	}
+}
+
+
+namespace seed {
+	using node_t = int64_t;
+
+	template <typename... Ts>
+	class HomogenousVector: public std::vector<std::variant<Ts...>> {
+		using std::vector<std::variant<Ts...>>::vector;
+
+		public:
+			template <typename T, typename... Xs>
+			node_t add(Xs&&... args) {
+				this->emplace_back(std::in_place_type<T>, std::forward<Xs>(args)...);
+				return { static_cast<int64_t>(this->size() - 1) };
+			}
+	};
+}
+
+
+namespace seed {
+	struct Position {
+		int line = 1, column = 1;
+	};
+
+
+	inline std::ostream& operator<<(std::ostream& os, const Position& pos) {
+		return (os << pos.line << ':' << pos.column);
+	}
+
+
+	inline Position position(const char* ptr, const char* const end) {
+		Position coord;
+		auto& [line, column] = coord;
+
+		while (ptr++ != end) {
+			if (*ptr == '\n') {
+				column = 1;
+				line++;
+			}
+
+			else {
+				column++;
+			}
+		}
+
+		return coord;
+	}
+
+
+	// Start of every line so positions can be found with a binary search
+	// instead of rescanning from the start of the file for each one.
+	class LineIndex {
+		private:
+			const char* start = nullptr;
+			std::vector<const char*> lines;
+
+
+		public:
+			LineIndex(const char* start_, const char* const end): start(start_) {
+				lines.emplace_back(start);
+
+				for (const char* ptr = start; (ptr = static_cast<const char*>(std::memchr(ptr, '\n', end - ptr))); ++ptr) {
+					lines.emplace_back(ptr + 1);
+				}
+			}
+
+			Position position(const char* ptr) const {
+				auto it = std::upper_bound(lines.begin(), lines.end(), ptr) - 1;
+				return { static_cast<int>(it - lines.begin()) + 1, static_cast<int>(ptr - *it) + 1 };
+			}
+	};
+
+
+	struct Diagnostic {
+		const char* at = nullptr;
+		std::string message;
+	};
+
+	using Diagnostics = std::vector<seed::Diagnostic>;
+
+
+	// Record an error in source order, unless the same one is already
+	// there from an earlier attempt at parsing the same text.
+	inline void diagnose(seed::Diagnostics& diags, const char* at, const char* msg) {
+		auto it = diags.end();
+
+		while (it != diags.begin() and (it - 1)->at >= at) {
+			if ((--it)->at == at and it->message == msg)
+				return;
+		}
+
+		diags.insert(it, { at, msg });
+	}
+
+
+	// Cost of a single root, filled in by `parse` and `render` when asked.
+	// The tree should be reserved up front or its growth is timed too.
+	struct RootProfile {
+		const char* at = nullptr;
+		Position pos;
+		uint64_t bytes = 0, nodes = 0, depth = 0;
+		double parse_us = 0, render_us = 0;
+	};
+
+	using Profile = std::vector<seed::RootProfile>;
+
+
+	// Counted into by `parse` and `render` when given, once per root to
+	// stay off the hot paths. It can be sampled from another thread.
+	struct Progress {
+		std::atomic<uint64_t> lexed{0};  // bytes of input.
+		std::atomic<uint64_t> nodes{0};
+		std::atomic<uint64_t> rendered{0};  // bytes of output.
+		std::atomic<uint64_t> done{0};  // bytes of input whose output is finished.
+	};
+
+
+	inline double micros(std::chrono::steady_clock::duration d) {
+		return std::chrono::duration<double, std::micro>(d).count();
+	}
+}
+
+
+namespace seed {
+	template <typename... Ts> struct overloaded: Ts... { using Ts::operator()...; };
+	template <typename... Ts> overloaded(Ts...) -> overloaded<Ts...>;
+
+	template <typename V, typename... Ts>
+	constexpr decltype(auto) visit(V&& variant, Ts&&... args) {
+		return std::visit(seed::overloaded{
+			std::forward<Ts>(args)...
+		}, variant);
+	}
+}
+
+
+
+namespace seed {
+	template <typename... Ts>
+	[[noreturn]] inline void error(Ts&&... args) {
+		([] () -> std::ostream& {
+			return (std::cerr << "error: ");
+		} () << ... << std::forward<Ts>(args)) << '\n';
+
+		std::exit(1);
+	}
+
+
+	inline std::string tabs(int n) {
+		return std::string(n, '\t');
+	}
+
+
+	// FNV-1a, used to key outputs by their input bytes.
+	constexpr uint64_t hash_bytes(const char* ptr, size_t length, uint64_t h = 0xcbf29ce484222325ull) {
+		for (size_t i = 0; i != length; ++i) {
+			h ^= static_cast<uint8_t>(ptr[i]);
+			h *= 0x100000001b3ull;
+		}
+
+		return h;
+	}
+
+	inline uint64_t hash_bytes(const std::string& str, uint64_t h = 0xcbf29ce484222325ull) {
+		return hash_bytes(str.data(), str.size(), h);
+	}
+
+
+	template <typename... Ts>
+	inline std::string strcat(Ts&&... args) {
+		std::string buf{sizeof...(Ts), '\0'};
+
+		std::stringstream ss{buf};
+		((ss << std::forward<Ts>(args)), ...);
+
+		return ss.str();
+	}
+}
+
+
+namespace seed {
+	#define TOKENS \
+		X(TOKEN_NONE) \
+		X(TOKEN_EOF) \
+		X(TOKEN_LPAREN) \
+		X(TOKEN_RPAREN) \
+		X(TOKEN_STRING) \
+		X(TOKEN_IDENTIFIER)
+
+	#define X(x) #x,
+		inline const char* to_str[] = { TOKENS };
+	#undef X
+
+	#define X(x) x,
+		enum { TOKENS };
+	#undef X
+
+	#undef TOKENS
+
+
+	inline seed::Token next_token(const char* const start, const char*& ptr) {
+		seed::Token tok{{ptr, 1}, TOKEN_NONE};
+
+		auto& [view, type] = tok;
+		auto& [vptr, vlen] = view;
+
+		if (*ptr == '\0') {
+			type = TOKEN_EOF;
+		}
+
+		else if (*ptr == '(') { type = TOKEN_LPAREN; ++ptr; }
+		else if (*ptr == ')') { type = TOKEN_RPAREN; ++ptr; }
+
+		else if ((*ptr == '"' or *ptr == '\'') and *(ptr - 1) != '\\') {
+			type = TOKEN_STRING;
+			char delim = *ptr;
+
+			do {
+				++ptr;
+			} while (*ptr != delim and *ptr);
+
+			++ptr;  // skip end quote.
+
+			// remove quotes.
+			vptr++;
+			vlen = ptr - vptr - 1;
+		}
+
+		else if (not seed::is_whitespace(*ptr)) {
+			type = TOKEN_IDENTIFIER;
+
+			if (*ptr == '\\') {
+				++vptr;
+			}
+
+			do {
+				++ptr;
+			} while (not seed::is_whitespace(*ptr) and not in_group(*ptr, '(', ')'));
+
+			vlen = ptr - vptr;
+		}
+
+		else if (seed::is_whitespace(*ptr)) {
+			do {
+				++ptr;
+			} while (seed::is_whitespace(*ptr));
+
+			return next_token(start, ptr);
+		}
+
+		else {
+			error(seed::position(start, ptr), ": unexpected character `", *ptr, "`(", (int)*ptr, ").");
+		}
+
+		return tok;
+	}
+
+
+	class Lexer {
+		private:
+			const char* const start = nullptr;
+			const char* str = nullptr;
+			Token lookahead{};
+
+
+		public:
+			Lexer(const char* const str_): start(str_), str{str_} {
+				advance();
+			}
+
+
+		public:
+			const Token& peek() const {
+				return lookahead;
+			}
+
+			Token advance() {
+				Token tok = peek();
+				lookahead = next_token(start, str);
+				return tok;
+			}
+
+			Position position() const {
+				return seed::position(start, str);
+			}
+
+			const char* source() const {
+				return start;
+			}
+
+			// Continue lexing from `ptr`.
+			void seek(const char* ptr) {
+				str = ptr;
+				advance();
+			}
+	};
+}
+
+
+namespace seed {
+	struct Identifer {
+		seed::Token tok;
+
+		Identifer(const seed::Token& tok_): tok(tok_) {}
+		Identifer(): tok() {}
+	};
+
+	struct String {
+		seed::Token tok;
+
+		String(const seed::Token& tok_): tok(tok_) {}
+		String(): tok() {}
+	};
+
+	struct List {
+		seed::Token op;
+		std::vector<seed::node_t> children;
+		seed::View span;  // source bytes from `(` to `)`.
+
+		List(const seed::Token& op_, const std::vector<seed::node_t>& children_, seed::View span_ = {}):
+			op(op_), children(children_), span(span_) {}
+		List(): op(), children(), span() {}
+	};
+
+	struct Empty {
+		seed::View span;
+
+		Empty(seed::View span_): span(span_) {}
+		Empty() {}
+	};
+
+	using AST = seed::HomogenousVector<List, Identifer, String, Empty>;
+}
+
+
+namespace seed {
+	// Parse a single form. When `diags` is given, errors are recorded there
+	// and -1 is returned instead of exiting.
+	inline seed::node_t expr(seed::Lexer& lex, seed::AST& tree, seed::Diagnostics* diags = nullptr) {
+		auto fail = [&] (const seed::Token& at, const char* msg) -> seed::node_t {
+			if (diags == nullptr)
+				error(lex.position(), ": ", msg);
+
+			seed::diagnose(*diags, at.view.begin, msg);
+			return -1;
+		};
+
+		seed::Token open = lex.advance();
+
+		if (open != TOKEN_LPAREN)
+			return fail(open, "expected `(`.");
+
+		seed::Token op = lex.advance();
+
+		if (op == TOKEN_RPAREN) {
+			return tree.add<Empty>(seed::View{open.view.begin, op.view.begin + 1});
+		}
+
+		else if (op != TOKEN_IDENTIFIER and op != TOKEN_STRING)
+			return fail(op, "expected identifer or string.");
+
+		std::vector<seed::node_t> children;
+
+		while (lex.peek() != TOKEN_RPAREN and lex.peek() != TOKEN_EOF) {
+			if (lex.peek() == TOKEN_LPAREN) {
+				seed::node_t child = expr(lex, tree, diags);
+
+				if (child == -1)
+					return -1;
+
+				children.emplace_back(child);
+			}
+
+			else if (lex.peek() == TOKEN_IDENTIFIER) {
+				children.emplace_back(tree.add<Identifer>(lex.advance()));
+			}
+
+			else if (lex.peek() == TOKEN_STRING) {
+				children.emplace_back(tree.add<String>(lex.advance()));
+			}
+		}
+
+		seed::Token close = lex.advance();
+
+		// Point at the form that is left open rather than the end of file.
+		if (close != TOKEN_RPAREN)
+			return fail(open, "expected `)`.");
+
+		return tree.add<List>(op, children, seed::View{open.view.begin, close.view.begin + 1});
+	}
+}
+
+
+namespace seed {
+	// Offsets of every node id written to a string, so that a rendered
+	// fragment can be moved to a different base id.
+	using Relocations = std::vector<uint32_t>;
+
+
+	template <typename T>
+	inline void render_nodes(
+		const T& variant,
+		const seed::AST& tree,
+		std::string& str,
+		const int indent_size, int parent_id, int& node_counter,
+		seed::Relocations* relocs = nullptr
+	) {
+		auto node = [&] (int self_id, const auto& label) {
+			auto at = static_cast<uint32_t>(str.size() + indent_size + 1);
+			str += tabs(indent_size) + strcat("n", self_id, " [label=\"", label, "\"];\n");
+
+			if (relocs != nullptr)
+				relocs->push_back(at);
+
+			if (self_id != parent_id) {
+				at = static_cast<uint32_t>(str.size() + indent_size + 1);
+				str += tabs(indent_size) + strcat("n", parent_id, " -> n", self_id, ";\n");
+
+				if (relocs != nullptr) {
+					relocs->push_back(at);
+					relocs->push_back(static_cast<uint32_t>(at + std::to_string(parent_id).size() + 5));
+				}
+			}
+		};
+
+		seed::visit(variant,
+			[&] (const List& l) {
+				int self_id = node_counter++;
+				node(self_id, l.op);
+
+				for (const auto& child: l.children) {
+					render_nodes(tree[child], tree, str, indent_size, self_id, node_counter, relocs);
+					node_counter++;
+				}
+			},
+
+			[&] (const Identifer& x) {
+				node(node_counter++, x.tok);
+			},
+
+			[&] (const String& x) {
+				std::string newstr;
+
+				for (auto chr: x.tok.str()) {
+					if (chr == '"')
+						newstr += "\\\"";
+					else
+						newstr += chr;
+				}
+
+				node(node_counter++, newstr);
+			},
+
+			[&] (const Empty&) {}
+		);
+	}
+
+
+	template <typename T>
+	inline void render_cluster(
+		const T& variant,
+		const seed::AST& tree,
+		std::string& str,
+		int& node_counter,
+		const std::string& title = "subgraph",
+		const int indent_size = 0
+	) {
+		str += tabs(indent_size) + title + " {\n";
+			render_nodes(variant, tree, str, indent_size + 1, node_counter, node_counter);
+			node_counter++;
+		str += tabs(indent_size) + "}\n";
+	}
+
+
+	inline std::string render(
+		const std::vector<seed::node_t>& roots,
+		const seed::AST& tree,
+		const std::string& title = "digraph",
+		const int indent_size = 0,
+		seed::Profile* profile = nullptr,
+		seed::Progress* progress = nullptr
+	) {
+		int node_counter = 0;
+		std::string str;
+
+		str += tabs(indent_size) + title + " {\n";
+
+		std::string scratch;  // profiled roots are rendered apart so the growth of `str` isn't timed.
+
+		int graph_id = 0;
+		for (const seed::node_t& n: roots) {
+			size_t before = str.size();
+			const std::string cluster = "subgraph cluster" + std::to_string(graph_id);
+
+			if (profile != nullptr) {
+				scratch.clear();
+
+				auto t0 = std::chrono::steady_clock::now();
+				render_cluster(tree[n], tree, scratch, node_counter, cluster, indent_size + 1);
+				(*profile)[graph_id].render_us = micros(std::chrono::steady_clock::now() - t0);
+
+				str += scratch;
+			}
+
+			else {
+				render_cluster(tree[n], tree, str, node_counter, cluster, indent_size + 1);
+			}
+
+			graph_id++;
+
+			if (progress != nullptr) {
+				progress->rendered.fetch_add(str.size() - before, std::memory_order_relaxed);
+
+				progress->done.fetch_add(static_cast<uint64_t>(seed::visit(tree[n],
+					[] (const List& l) { return l.span.length; },
+					[] (const Empty& e) { return e.span.length; },
+					[] (const auto&) { return 0; }
+				)), std::memory_order_relaxed);
+			}
+		}
+
+		str += tabs(indent_size) + "}\n";
+
+		return str;
+	}
+}
+
+
+namespace seed {
+	inline std::vector<seed::node_t> parse(seed::Lexer& lex, seed::AST& tree) {
+		std::vector<seed::node_t> roots;
+
+		while (lex.peek() != seed::TOKEN_EOF) {
+			roots.emplace_back(seed::expr(lex, tree));
+		}
+
+		return roots;
+	}
+
+
+	// Skip past a broken form starting at `open`: to the end of it if it is
+	// balanced, otherwise it is reported as unclosed and parsing resumes at
+	// the first `(` at the start of a line inside it, which is most likely
+	// the next top level form. Forms there are parsed again, errors already
+	// reported for them are not recorded twice.
+	inline void recover(seed::Lexer& lex, const char* open, seed::Diagnostics& diags) {
+		const char* const start = lex.source();
+		const char* ptr = open;
+		const char* resync = nullptr;
+		int depth = 0;
+
+		seed::Token tok = next_token(start, ptr);
+
+		for (; tok != TOKEN_EOF; tok = next_token(start, ptr)) {
+			const char* at = tok.view.begin;
+
+			if (tok == TOKEN_LPAREN) {
+				if (resync == nullptr and depth > 0 and *(at - 1) == '\n')
+					resync = at;
+
+				++depth;
+			}
+
+			else if (tok == TOKEN_RPAREN and --depth == 0) {
+				break;
+			}
+		}
+
+		if (tok != TOKEN_EOF) {
+			lex.seek(ptr);
+			return;
+		}
+
+		seed::diagnose(diags, open, "expected `)`.");
+		lex.seek(resync != nullptr ? resync : ptr);
+	}
+
+
+	// Parse every form it can, collecting all errors in one pass. Broken
+	// forms are skipped and left out of the roots.
+	inline std::vector<seed::node_t> parse(
+		seed::Lexer& lex,
+		seed::AST& tree,
+		seed::Diagnostics& diags,
+		seed::Profile* profile = nullptr,
+		seed::Progress* progress = nullptr
+	) {
+		std::vector<seed::node_t> roots;
+
+		while (lex.peek() != seed::TOKEN_EOF) {
+			seed::Token first = lex.peek();
+			size_t nodes = tree.size();
+
+			auto t0 = profile ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+			seed::node_t n = seed::expr(lex, tree, &diags);
+
+			if (profile != nullptr and n != -1) {
+				seed::RootProfile p;
+
+				p.parse_us = micros(std::chrono::steady_clock::now() - t0);
+				p.at = first.view.begin;
+				p.bytes = static_cast<uint64_t>(seed::visit(tree[n],
+					[] (const List& l) { return l.span.length; },
+					[] (const Empty& e) { return e.span.length; },
+					[] (const auto&) { return 0; }
+				));
+
+				profile->emplace_back(p);
+			}
+
+			if (progress != nullptr) {
+				progress->lexed.fetch_add(static_cast<uint64_t>(lex.peek().view.begin - first.view.begin), std::memory_order_relaxed);
+				progress->nodes.fetch_add(tree.size() - nodes, std::memory_order_relaxed);
+			}
+
+			if (n != -1) {
+				roots.emplace_back(n);
+			}
+
+			else if (first != seed::TOKEN_LPAREN) {
+				while (lex.peek() != seed::TOKEN_LPAREN and lex.peek() != seed::TOKEN_EOF) {
+					lex.advance();
+				}
+			}
+
+			else {
+				seed::recover(lex, first.view.begin, diags);
+			}
+		}
+
+		return roots;
+	}
+}
+
+
+namespace seed {
+	// Builds an `AST` directly instead of printing s-expressions only for
+	// them to be parsed again. Labels are copied into a pool owned by the
+	// builder so it must outlive any use of its tree.
+	//
+	//   seed::Builder b;
+	//   b.root(b.list("define", { b.identifier("x"), b.string("y") }));
+	//   std::cout << seed::render(b.roots(), b.tree());
+	class Builder {
+		private:
+			static constexpr size_t chunk_size = 64 * 1024;
+
+			std::vector<std::unique_ptr<char[]>> chunks;
+			size_t used = chunk_size;
+
+			seed::AST nodes;
+			std::vector<seed::node_t> root_nodes;
+
+
+		private:
+			char* allocate(size_t length) {
+				// Oversized labels get a chunk of their own.
+				if (length > chunk_size) {
+					chunks.emplace_back(new char[length]);
+					used = chunk_size;
+
+					return chunks.back().get();
+				}
+
+				if (used + length > chunk_size) {
+					chunks.emplace_back(new char[chunk_size]);
+					used = 0;
+				}
+
+				char* ptr = chunks.back().get() + used;
+				used += length;
+
+				return ptr;
+			}
+
+			// Every label is surrounded by nul bytes so nothing that looks
+			// around a token (escapes, the quotes of a string's span) reads
+			// outside the pool.
+			seed::View intern(std::string_view str) {
+				char* ptr = allocate(str.size() + 2);
+
+				ptr[0] = '\0';
+				std::memcpy(ptr + 1, str.data(), str.size());
+				ptr[str.size() + 1] = '\0';
+
+				return { ptr + 1, static_cast<int>(str.size()) };
+			}
+
+
+		public:
+			seed::node_t identifier(std::string_view label) {
+				return nodes.add<Identifer>(seed::Token{intern(label), TOKEN_IDENTIFIER});
+			}
+
+			seed::node_t string(std::string_view label) {
+				return nodes.add<String>(seed::Token{intern(label), TOKEN_STRING});
+			}
+
+			seed::node_t empty() {
+				return nodes.add<Empty>();
+			}
+
+			seed::node_t list(std::string_view op, const std::vector<seed::node_t>& children = {}) {
+				return nodes.add<List>(seed::Token{intern(op), TOKEN_IDENTIFIER}, children);
+			}
+
+			Builder& root(seed::node_t n) {
+				root_nodes.emplace_back(n);
+				return *this;
+			}
+
+
+		public:
+			const seed::AST& tree() const {
+				return nodes;
+			}
+
+			seed::AST& tree() {
+				return nodes;
+			}
+
+			const std::vector<seed::node_t>& roots() const {
+				return root_nodes;
+			}
+
+			std::vector<seed::node_t>& roots() {
+				return root_nodes;
+			}
+	};
+}